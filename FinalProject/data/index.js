@@ -23,9 +23,14 @@ clearWifi.addEventListener("click", function(){
 });
 
 var gateway = `ws://${window.location.hostname}/ws`;
+// Binary live samples, see decodeSampleFrame()
+const sampleProtocol = 'tempsamples.v1';
 var websocket;
 var chart;
-var dates = [];
+// Chart series keyed by sensor ID
+var sensorSeries = {};
+// Upper bound on the history points the device sends for the chart
+const chartPoints = 300;
 
 window.addEventListener('load', onLoad);
 
@@ -35,14 +40,18 @@ function onLoad(event) {
 }
 
 function initWebSocket() {
-    websocket = new WebSocket(gateway);
+    websocket = new WebSocket(gateway, [sampleProtocol]);
+    websocket.binaryType = 'arraybuffer';
     websocket.onopen = onOpen;
     websocket.onclose = onClose;
     websocket.onmessage = onMessage;
 }
 
+// The device subscribes every client to 'samples', probe alarms are asked for here.
+// Other topics: 'sensor/<id>', optionally with {interval: ms} between updates.
 function onOpen(event) {
     console.log('Connection opened');
+    websocket.send(JSON.stringify({ subscribe: ['alarms'] }));
     getData(); // Initial data fetch
 }
 
@@ -52,12 +61,48 @@ function onClose(event) {
 }
 
 function onMessage(event) {
-    console.log('Message received:', event.data);
-    appendDataToChart(event.data);
+    if (event.data instanceof ArrayBuffer) {
+        appendSamplesToChart(decodeSampleFrame(event.data));
+    } else if (event.data.startsWith('{')) {
+        handleTopicMessage(JSON.parse(event.data));
+    } else {
+        event.data.split('\n').forEach(appendDataToChart);
+    }
+}
+
+function handleTopicMessage(message) {
+    if (message.error) {
+        console.error(`Subscription failed: ${message.error} ${message.topic || ''}`);
+    } else if (message.topic === 'alarms') {
+        console.warn(`Sensor ${message.sensor} ${message.state === 'lost' ? 'stopped answering' : 'is back'}`);
+    }
+}
+
+// Little-endian frame: u8 version, u8 count, u16 record size, u64 epoch ms of the first sample,
+// then per sample i32 ms after the first, u8 sensor, u8 reserved, i16 temperature in 1/100 °C
+// Times are in ms but only have 1 s resolution, samples are stamped in whole seconds
+function decodeSampleFrame(buffer) {
+    const view = new DataView(buffer);
+    if (view.byteLength < 12 || view.getUint8(0) !== 1) {
+        return [];
+    }
+    const count = view.getUint8(1);
+    const recordSize = view.getUint16(2, true);
+    const base = view.getUint32(4, true) + view.getUint32(8, true) * 4294967296;
+
+    const samples = [];
+    for (let i = 0, offset = 12; i < count && offset + 8 <= view.byteLength; i++, offset += recordSize) {
+        samples.push({
+            time: base + view.getInt32(offset, true),
+            sensor: view.getUint8(offset + 4),
+            temperature: view.getInt16(offset + 6, true) / 100
+        });
+    }
+    return samples;
 }
 
 function getData(){
-    fetch("/getdata").then(response => response.text())
+    fetch(`/getdata?points=${chartPoints}`).then(response => response.text())
     .then(csvData => {
         updateChart(csvData);
     });
@@ -69,7 +114,7 @@ function initChart() {
             text: 'Temperature over Time'
         },
         xAxis: {
-            categories: [],
+            type: 'datetime',
             title: {
                 text: 'Date'
             }
@@ -79,40 +124,64 @@ function initChart() {
                 text: 'Temperature (°C)'
             }   
         },
-        series: [{
+        series: []
+    });
+}
+
+// Timestamps are sent as device wall-clock time, keep them as-is on the axis
+function parseTime(text) {
+    return Date.parse(text.replace(' ', 'T') + 'Z');
+}
+
+function seriesForSensor(sensor) {
+    if (!(sensor in sensorSeries)) {
+        sensorSeries[sensor] = chart.addSeries({
             type: 'line',
-            name: 'Temperature',
+            name: `Sensor ${sensor}`,
             data: []
-        }]
-    });
+        }, false);
+    }
+    return sensorSeries[sensor];
 }
 
 function updateChart(csvData) {
     // Split the CSV data into rows
     const rows = csvData.trim().split('\n');
-    // Extract the data rows
-    const dataRows = rows.slice(1).map(row => {
+    // Group the data rows by sensor
+    const points = {};
+    rows.slice(1).forEach(row => {
         const values = row.split(',');
-        return { date: values[0], temperature: parseFloat(values[1]) }; // Convert temperature to a number
+        const sensor = values[1];
+        if (!(sensor in points)) {
+            points[sensor] = [];
+        }
+        points[sensor].push([parseTime(values[0]), parseFloat(values[2])]); // Convert temperature to a number
     });
 
-    dates = dataRows.map(row => row.date);
-    const temperatures = dataRows.map(row => row.temperature);
-
     // Update the chart with new data
-    chart.xAxis[0].setCategories(dates);
-    chart.series[0].setData(temperatures);
+    for (const sensor in points) {
+        seriesForSensor(sensor).setData(points[sensor], false);
+    }
+    chart.redraw();
 }
 
 function appendDataToChart(csvRow) {
     const values = csvRow.split(',');
-    const date = values[0];
-    const temperature = parseFloat(values[1]);
+    const time = parseTime(values[0]);
+    const sensor = values[1];
+    const temperature = parseFloat(values[2]);
 
     // Add the new point to the chart
-    dates.push(date);
-    chart.xAxis[0].setCategories(dates);
-    chart.series[0].addPoint(temperature, true, false);
+    seriesForSensor(sensor).addPoint([time, temperature], true, false);
+}
+
+function appendSamplesToChart(samples) {
+    samples.forEach(sample => {
+        seriesForSensor(sample.sensor).addPoint([sample.time, sample.temperature], false, false);
+    });
+    if (samples.length > 0) {
+        chart.redraw();
+    }
 }
 
 function deleteData(){
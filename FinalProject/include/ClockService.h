@@ -0,0 +1,80 @@
+/**
+ * @file ClockService.h
+ * @brief Wall-clock time kept locally and corrected from NTP now and then.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <NTPClient.h>
+
+/**
+ * @brief Cheap, thread-safe wall-clock time on top of the ESP32 monotonic timer.
+ *
+ * The service anchors the monotonic timer to the NTP epoch and extrapolates from
+ * there, correcting for the drift of the local oscillator that NTPClient has
+ * measured. While syncs keep confirming the clock, the sync interval is doubled
+ * up to a maximum, which saves radio time.
+ *
+ * update() refreshes that offset from NTP once per sync interval and is the only
+ * place that touches the network. It never blocks: a request is sent on one call
+ * and its answer picked up on a later one. now() and nowMs() just add the offset
+ * to the timer and can be called from any task as often as needed.
+ */
+class ClockService {
+  public:
+    /**
+     * @param ntp NTP client to sync from, already configured with the time offset.
+     * @param syncInterval Shortest time between successful syncs in ms.
+     * @param maxSyncInterval Longest time between successful syncs in ms.
+     * @param retryInterval Time before retrying a failed sync in ms.
+     */
+    ClockService(NTPClient &ntp, unsigned long syncInterval, unsigned long maxSyncInterval, unsigned long retryInterval = 5000);
+
+    /**
+     * @brief Sync from NTP if it is due. Call from loop().
+     *
+     * @return True if a sync happened during this call.
+     */
+    bool update();
+
+    /**
+     * @return True once the clock has been synced from NTP at least once.
+     */
+    bool synced() const { return _synced; }
+
+    /**
+     * @return Seconds since Jan. 1, 1970, or since boot before the first sync.
+     */
+    uint32_t now() const { return nowMs() / 1000; }
+
+    /**
+     * @return Milliseconds since Jan. 1, 1970, or since boot before the first sync.
+     */
+    uint64_t nowMs() const;
+
+    /**
+     * @return Time until the next sync once the current one succeeds, in ms.
+     */
+    unsigned long syncInterval() const { return _currentInterval; }
+
+    // A sync that moves the clock by less than this counts as confirming it
+    static const long STABLE_CORRECTION_MS = 20;
+
+  private:
+    NTPClient &_ntp;
+    unsigned long _syncInterval;
+    unsigned long _maxSyncInterval;
+    unsigned long _currentInterval;
+    unsigned long _retryInterval;
+    unsigned long _lastAttempt = 0;
+    bool _lastAttemptOk = false;
+    volatile bool _synced = false;
+    int64_t _anchorEpochMs = 0;  // Epoch ms at the last sync
+    int64_t _anchorMonoMs = 0;   // Monotonic ms at the last sync
+    float _driftPpm = 0;
+    mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    void apply();
+    static int64_t monotonicMs();
+};
@@ -0,0 +1,124 @@
+/**
+ * @file Downsampler.h
+ * @brief Min/max/average bucketing of a sample range down to a fixed number of points.
+ *
+ * One Downsampler summarises one series, callers keep one per sensor.
+ * DownsampledExporter streams the buckets of every sensor as CSV.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "SampleStore.h"
+#include "SampleExport.h"
+
+/**
+ * @brief Summary of consecutive samples.
+ */
+struct SampleBucket {
+  uint32_t epoch;  ///< Mean time of the samples in the bucket.
+  int16_t minC;    ///< Lowest temperature in 1/100 °C.
+  int16_t maxC;    ///< Highest temperature in 1/100 °C.
+  int16_t avgC;    ///< Mean temperature in 1/100 °C.
+  uint32_t count;  ///< Number of samples summarised.
+  uint8_t sensor;  ///< ID of the probe the samples came from.
+};
+
+class Downsampler {
+  public:
+    /**
+     * @param total Number of samples that will be fed in.
+     * @param points Maximum number of buckets to produce.
+     */
+    Downsampler(uint32_t total = 0, uint32_t points = 1);
+
+    /**
+     * @brief Add the next sample.
+     *
+     * @param sample Sample to add, in chronological order.
+     * @param out Receives the finished bucket when one is complete.
+     * @return True if out was filled.
+     */
+    bool add(const Sample &sample, SampleBucket &out);
+
+    /**
+     * @brief Emit the last, partially filled bucket.
+     *
+     * @return True if out was filled.
+     */
+    bool flush(SampleBucket &out);
+
+    uint32_t bucketSize() const { return _bucketSize; }
+
+  private:
+    uint32_t _bucketSize;
+    uint32_t _count = 0;
+    uint64_t _epochSum = 0;
+    int64_t _tempSum = 0;
+    int16_t _min = 0;
+    int16_t _max = 0;
+    uint8_t _sensor = 0;
+
+    void emit(SampleBucket &out);
+};
+
+/**
+ * @brief Streams the buckets of a time range of the store as CSV, a piece at a time.
+ *
+ * Each call reads on from a cursor into the store, so memory use is fixed by one
+ * batch, one row and a Downsampler per sensor however long the range is.
+ * Intended as the filler of a chunked web response.
+ */
+class DownsampledExporter {
+  public:
+    static const uint8_t MAX_SENSORS = 8;
+
+    /**
+     * @param store Store to read from.
+     * @param from First epoch to include.
+     * @param to Last epoch to include.
+     * @param points Maximum number of buckets per sensor.
+     * @param sensor Only export this sensor, UINT32_MAX for all of them.
+     * @param sensors Number of sensors whose samples share the store, which sets
+     *                the bucket size whether or not one sensor is picked.
+     */
+    DownsampledExporter(SampleStore &store, uint32_t from, uint32_t to, uint32_t points, uint32_t sensor, uint8_t sensors);
+
+    /**
+     * @brief Write the next part of the export.
+     *
+     * @param buf Destination buffer.
+     * @param maxLen Size of the destination buffer.
+     * @return Number of bytes written, 0 once the export is complete.
+     */
+    size_t fill(uint8_t *buf, size_t maxLen);
+
+    /**
+     * @brief Format a bucket as `time,sensor,mean,min,max` followed by a newline.
+     *
+     * @param buf Destination buffer, at least SAMPLE_ROW_MAX bytes.
+     * @return Number of characters written, 0 if the buffer is too small.
+     */
+    static size_t formatRow(const SampleBucket &bucket, char *buf, size_t len);
+
+  private:
+    static const size_t BATCH_SIZE = 32;
+
+    SampleStore &_store;
+    uint32_t _sensor;
+    uint32_t _index;
+    uint32_t _end;
+    bool _headerDone = false;
+    uint8_t _flushed = 0;  // Sensors whose last bucket has been emitted
+    Downsampler _downsamplers[MAX_SENSORS];
+
+    Sample _batch[BATCH_SIZE];
+    size_t _batchLen = 0;
+    size_t _batchPos = 0;
+
+    char _row[SAMPLE_ROW_MAX];
+    size_t _rowLen = 0;
+    size_t _rowPos = 0;
+
+    bool nextRow();
+};
@@ -0,0 +1,127 @@
+/**
+ * @file SampleExport.h
+ * @brief Streaming CSV/NDJSON encoder for a time range of the sample store,
+ *        and the binary frame format of live samples.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "SampleStore.h"
+
+// Buffer sizes, including the terminating NUL, that the formatters below need
+#define SAMPLE_ROW_MAX 96
+#define TIMESTAMP_MAX 20
+#define CENTIC_MAX 8
+
+// WebSocket subprotocol of binary live-sample frames, see encodeSampleFrame()
+#define SAMPLE_PROTOCOL "tempsamples.v1"
+#define SAMPLE_FRAME_VERSION 1
+#define SAMPLE_FRAME_HEADER 12
+#define SAMPLE_FRAME_RECORD 8
+#define SAMPLE_FRAME_MAX_SAMPLES 32
+#define SAMPLE_FRAME_MAX (SAMPLE_FRAME_HEADER + SAMPLE_FRAME_MAX_SAMPLES * SAMPLE_FRAME_RECORD)
+
+enum class ExportFormat {
+  CSV,
+  NDJSON
+};
+
+/**
+ * @brief Encodes samples into caller-provided buffers a piece at a time.
+ *
+ * Memory use is fixed by the batch and row buffers, no matter how many samples
+ * the range holds. Intended as the filler of a chunked web response.
+ *
+ * The formatters write into caller-provided buffers with integer arithmetic and
+ * never allocate, so they are also used for every live sample.
+ */
+class SampleExporter {
+  public:
+    /**
+     * @param store Store to read from.
+     * @param format Output encoding.
+     * @param from First epoch to export, inclusive.
+     * @param to Last epoch to export, inclusive.
+     */
+    SampleExporter(SampleStore &store, ExportFormat format, uint32_t from, uint32_t to);
+
+    /**
+     * @brief Write the next part of the export.
+     *
+     * @param buf Destination buffer.
+     * @param maxLen Size of the destination buffer.
+     * @return Number of bytes written, 0 once the export is complete.
+     */
+    size_t fill(uint8_t *buf, size_t maxLen);
+
+    /**
+     * @brief Format the header line of an export, if the format has one.
+     *
+     * @return Number of characters written.
+     */
+    static size_t formatHeader(ExportFormat format, char *buf, size_t len);
+
+    /**
+     * @brief Format one sample as a complete, NUL-terminated line.
+     *
+     * @param buf Destination buffer, at least SAMPLE_ROW_MAX bytes.
+     * @return Number of characters written, 0 if the buffer is too small.
+     */
+    static size_t formatRow(ExportFormat format, const Sample &sample, char *buf, size_t len);
+
+  private:
+    static const size_t BATCH_SIZE = 16;
+    static const size_t ROW_SIZE = SAMPLE_ROW_MAX;
+
+    SampleStore &_store;
+    ExportFormat _format;
+    uint32_t _index;
+    uint32_t _end;
+    bool _headerDone = false;
+
+    Sample _batch[BATCH_SIZE];
+    size_t _batchLen = 0;
+    size_t _batchPos = 0;
+
+    char _row[ROW_SIZE];
+    size_t _rowLen = 0;
+    size_t _rowPos = 0;
+
+    bool nextRow();
+};
+
+/**
+ * @brief Format an epoch as `YYYY-MM-DD hh:mm:ss`.
+ *
+ * @param epoch Seconds since Jan. 1, 1970.
+ * @param buf Destination buffer, at least TIMESTAMP_MAX bytes.
+ * @param len Size of the destination buffer.
+ * @return Number of characters written, 0 if the buffer is too small.
+ */
+size_t formatTimestamp(uint32_t epoch, char *buf, size_t len);
+
+/**
+ * @brief Format a temperature in 1/100 °C as a decimal with two fraction digits.
+ *
+ * @param buf Destination buffer, at least CENTIC_MAX bytes.
+ * @return Number of characters written, 0 if the buffer is too small.
+ */
+size_t formatCentiC(int16_t centiC, char *buf, size_t len);
+
+/**
+ * @brief Pack samples into one binary frame, all fields little-endian.
+ *
+ * Header: u8 version, u8 sample count, u16 record size, u64 epoch in ms of the
+ * first sample. Each record: i32 ms relative to the first sample, u8 sensor,
+ * u8 reserved, i16 temperature in 1/100 °C. Readers step by the record size,
+ * so fields can be appended to records later.
+ *
+ * Samples are stamped and stored in whole seconds, so the ms fields only have
+ * 1 s resolution for now: the base is a multiple of 1000 and so is every
+ * offset. The unit leaves room for finer stamps without a new frame version.
+ *
+ * @param buf Destination buffer, at least SAMPLE_FRAME_MAX bytes for a full batch.
+ * @return Number of bytes written, 0 if count is 0 or too large, or the buffer is too small.
+ */
+size_t encodeSampleFrame(const Sample *samples, size_t count, uint8_t *buf, size_t len);
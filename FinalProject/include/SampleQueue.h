@@ -0,0 +1,76 @@
+/**
+ * @file SampleQueue.h
+ * @brief Lock-free single-producer/single-consumer ring buffer.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+ * @brief Fixed-capacity FIFO shared by exactly one producer and one consumer task.
+ *
+ * The producer only writes _head and the consumer only writes _tail, so neither
+ * side ever takes a lock or waits on the other. One slot is kept free to tell a
+ * full ring from an empty one.
+ *
+ * @tparam T Item type, copied in and out.
+ * @tparam N Number of slots, must be a power of two.
+ */
+template <typename T, size_t N>
+class SampleQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SampleQueue size must be a power of two");
+
+  public:
+    /**
+     * @brief Add an item. Producer side only.
+     *
+     * @return False if the queue is full and the item was dropped.
+     */
+    bool push(const T &item) {
+      size_t head = _head.load(std::memory_order_relaxed);
+      size_t next = (head + 1) & (N - 1);
+      if (next == _tail.load(std::memory_order_acquire)) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      _items[head] = item;
+      _head.store(next, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief Take the oldest item. Consumer side only.
+     *
+     * @return False if the queue is empty.
+     */
+    bool pop(T &item) {
+      size_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail == _head.load(std::memory_order_acquire)) {
+        return false;
+      }
+      item = _items[tail];
+      _tail.store((tail + 1) & (N - 1), std::memory_order_release);
+      return true;
+    }
+
+    size_t size() const {
+      return (_head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire)) & (N - 1);
+    }
+
+    bool empty() const { return size() == 0; }
+
+    static constexpr size_t capacity() { return N - 1; }
+
+    /**
+     * @return Number of items rejected because the queue was full.
+     */
+    size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+  private:
+    T _items[N];
+    std::atomic<size_t> _head{0};
+    std::atomic<size_t> _tail{0};
+    std::atomic<size_t> _dropped{0};
+};
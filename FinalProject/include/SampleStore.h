@@ -0,0 +1,173 @@
+/**
+ * @file SampleStore.h
+ * @brief Fixed-size binary ring buffer of temperature samples kept on a file system.
+ *
+ * The file starts with a one-sector header holding the write cursor, followed by
+ * fixed-width records. Once the ring is full the oldest record is overwritten, so
+ * every append costs the same no matter how much history is kept.
+ *
+ * Appends are collected in a one-sector RAM page and written out as whole,
+ * sector-aligned blocks when the page fills up, when the flush policy says so
+ * or when flush() is called. Readers see buffered samples straight away.
+ *
+ * Every record carries a checksum. On startup only the sector under the
+ * persisted cursor is checked: records written after the last cursor update
+ * are taken back in and a torn tail is cut off, so opening the store costs the
+ * same however much history it holds. A file that cannot be used is moved
+ * aside rather than overwritten.
+ *
+ * clear() only rewrites the header. It raises an epoch floor stored there, and
+ * records older than the floor no longer count as valid, so the old records
+ * left in the file can never be taken back in.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "FS.h"
+
+/**
+ * @brief One stored temperature sample.
+ */
+struct Sample {
+  uint32_t epoch;    ///< Seconds since Jan. 1, 1970 (local time, as reported by NTPClient).
+  int16_t centiC;    ///< Temperature in 1/100 °C.
+  uint8_t sensor;    ///< ID of the probe in the sensor registry.
+  uint8_t check;     ///< CRC-8 of the other fields, set by the store.
+};
+
+class SampleStore {
+  public:
+    static const uint32_t MAGIC = 0x31535354; // "TSS1"
+    static const uint16_t VERSION = 3;
+    static const uint16_t MIN_VERSION = 2;  // Version 2 headers lack the epoch floor, it reads as 0
+    static const uint32_t SECTOR_SIZE = 512;
+    static const uint32_t HEADER_SIZE = SECTOR_SIZE;  // Records start on a sector boundary
+    static const uint32_t RECORDS_PER_PAGE = SECTOR_SIZE / sizeof(Sample);
+
+    /**
+     * @param fs File system holding the store.
+     * @param path Path of the store file.
+     * @param capacity Number of records kept before the oldest is overwritten.
+     */
+    SampleStore(fs::FS &fs, const char *path, uint32_t capacity);
+
+    /**
+     * @brief Open the store, creating it if it is missing or its layout does not match.
+     *
+     * @return True if the store is ready for use.
+     */
+    bool begin();
+
+    /**
+     * @brief Append a sample, overwriting the oldest one once the ring is full.
+     *
+     * The sample is buffered and only written once its page is flushed. Samples
+     * older than the newest one stored or than the last clear() are rejected, so
+     * a clock stepped back cannot break the time order seek() relies on.
+     *
+     * @return True if the sample was accepted and any flush it caused succeeded.
+     */
+    bool append(const Sample &sample);
+
+    /**
+     * @brief Write buffered samples and the cursor to the file.
+     *
+     * @return True if nothing was pending or everything was written.
+     */
+    bool flush();
+
+    /**
+     * @brief Flush if the oldest buffered sample is older than the flush age.
+     *
+     * @return False only if a flush was due and failed.
+     */
+    bool flushIfDue();
+
+    /**
+     * @brief Set when buffered samples are written without waiting for a full page.
+     *
+     * @param maxRecords Flush once this many samples are pending, capped at a page.
+     * @param maxAgeMs Flush once the oldest pending sample is this old, 0 to disable.
+     */
+    void setFlushPolicy(uint32_t maxRecords, unsigned long maxAgeMs);
+
+    /**
+     * @return Number of samples not written to the file yet.
+     */
+    uint32_t pending() const { return _pending; }
+
+    /**
+     * @brief Read consecutive samples in chronological order.
+     *
+     * @param index Logical index of the first sample, 0 being the oldest.
+     * @param out Destination array.
+     * @param count Maximum number of samples to read.
+     * @return Number of samples read.
+     */
+    size_t read(uint32_t index, Sample *out, size_t count);
+
+    /**
+     * @brief Find the first sample taken at or after a point in time.
+     *
+     * @param epoch Time to look for, in seconds since Jan. 1, 1970.
+     * @return Logical index of that sample, or size() if there is none.
+     */
+    uint32_t seek(uint32_t epoch);
+
+    /**
+     * @brief Drop every stored sample.
+     *
+     * Samples appended afterwards must be newer than the newest one dropped.
+     */
+    bool clear();
+
+    uint32_t size() const { return _count; }
+    uint32_t capacity() const { return _capacity; }
+
+    static int16_t toCentiC(float tempC);
+    static float fromCentiC(int16_t centiC);
+
+    /**
+     * @return CRC-8 of a record, not counting its check field.
+     */
+    static uint8_t checksum(const Sample &sample);
+
+  private:
+    struct Header {
+      uint32_t magic;
+      uint16_t version;
+      uint16_t recordSize;
+      uint32_t capacity;
+      uint32_t head;   // Next slot to write
+      uint32_t count;  // Valid records
+      uint32_t epochFloor;  // Records older than this were dropped by clear()
+    };
+
+    fs::FS &_fs;
+    const char *_path;
+    uint32_t _capacity;
+    uint32_t _head = 0;
+    uint32_t _count = 0;
+    uint32_t _epochFloor = 0;
+    uint32_t _newestEpoch = 0;  // Epoch of the newest record, appends may not go below it
+    File _file;
+    SemaphoreHandle_t _lock;
+
+    Sample _page[RECORDS_PER_PAGE];     // Contents of the sector holding the head slot
+    uint32_t _pageFirst = UINT32_MAX;   // First slot of the buffered sector
+    uint32_t _pending = 0;
+    unsigned long _pendingSince = 0;
+    uint32_t _flushRecords = RECORDS_PER_PAGE;
+    unsigned long _flushAgeMs = 60000;
+
+    bool create();
+    bool recover();
+    bool isValid(const Sample &sample) const;
+    bool writeHeader();
+    bool loadPage(uint32_t first);
+    bool writePage();
+    bool flushLocked();
+    uint32_t slotOf(uint32_t index) const;
+    bool readSlot(uint32_t slot, Sample *out, size_t count);
+};
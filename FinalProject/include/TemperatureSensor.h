@@ -0,0 +1,118 @@
+/**
+ * @file TemperatureSensor.h
+ * @brief Non-blocking acquisition from every DS18B20 on the OneWire bus.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <DallasTemperature.h>
+#include "FS.h"
+
+#define MAX_TEMPERATURE_SENSORS 8
+
+/**
+ * @brief Registry of the DS18B20 probes on one bus, read with a single broadcast.
+ *
+ * Addresses are discovered once and cached, so reads go straight to each device
+ * instead of searching the bus by index. A probe keeps its ID while it is
+ * unplugged and gets it back when it returns. The bus is searched again when a
+ * probe stops answering and every RESCAN_PERIOD conversions to pick up new ones.
+ *
+ * IDs tag the stored samples, so they are never handed to another probe: the
+ * registry is saved to a file and kept across restarts, and a new probe found
+ * while every ID is taken is left out and logged.
+ *
+ * start() broadcasts a conversion to all probes and returns straight away;
+ * poll() is called from loop() and collects the results once the conversion
+ * time for the current resolution has passed.
+ */
+class TemperatureSensor {
+  public:
+    enum State {
+      IDLE,
+      CONVERTING
+    };
+
+    static const uint8_t RESCAN_PERIOD = 20;
+
+    /**
+     * @param sensors Bus to read.
+     * @param fs File system holding the registry.
+     * @param path Path of the registry file.
+     */
+    TemperatureSensor(DallasTemperature &sensors, fs::FS &fs, const char *path);
+
+    /**
+     * @brief Load the registry, discover the probes and switch to asynchronous conversions.
+     */
+    void begin();
+
+    /**
+     * @brief Search the bus and update the registry.
+     *
+     * @return Number of probes present.
+     */
+    uint8_t scan();
+
+    /**
+     * @brief Start a conversion on every probe unless one is already running.
+     */
+    void start();
+
+    /**
+     * @brief Collect the running conversion if it is done.
+     *
+     * @return True if new readings were taken during this call.
+     */
+    bool poll();
+
+    State state() const { return _state; }
+
+    /**
+     * @return Number of registry slots in use, sensor IDs are below this.
+     */
+    uint8_t count() const { return _slotCount; }
+
+    /**
+     * @return Number of probes currently present.
+     */
+    uint8_t present() const;
+
+    bool present(uint8_t id) const { return id < _slotCount && _slots[id].present; }
+
+    /**
+     * @return True if the last reading of the probe succeeded.
+     */
+    bool valid(uint8_t id) const { return id < _slotCount && _slots[id].valid; }
+
+    /**
+     * @return Last reading of the probe in Celsius, only meaningful when valid().
+     */
+    float tempC(uint8_t id) const { return _slots[id].tempC; }
+
+    const uint8_t *address(uint8_t id) const { return _slots[id].address; }
+
+  private:
+    struct Slot {
+      DeviceAddress address;
+      bool present;
+      bool valid;
+      float tempC;
+    };
+
+    DallasTemperature &_sensors;
+    fs::FS &_fs;
+    const char *_path;
+    State _state = IDLE;
+    unsigned long _startedAt = 0;
+    unsigned long _conversionTime = 750;
+    Slot _slots[MAX_TEMPERATURE_SENSORS];
+    uint8_t _slotCount = 0;
+    uint8_t _sinceScan = 0;
+    bool _rescan = false;
+
+    int findSlot(const DeviceAddress address) const;
+    void load();
+    bool save();
+};
@@ -0,0 +1,108 @@
+/**
+ * @file TopicRegistry.h
+ * @brief Per-topic lists of the WebSocket clients subscribed to it.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <functional>
+
+#define MAX_TOPICS 16
+#define TOPIC_NAME_MAX 16
+#define MAX_TOPIC_SUBSCRIBERS DEFAULT_MAX_WS_CLIENTS
+
+/**
+ * @brief Server-side subscriptions of WebSocket clients to named topics.
+ *
+ * Every topic keeps its own list of subscribers, so publishing to a topic only
+ * visits the clients interested in it and a topic nobody listens to costs
+ * nothing beyond a size check. Each subscription carries a minimum interval:
+ * a client asking for one update every few seconds is skipped by the messages
+ * published in between.
+ *
+ * Topics are registered up front, clients can only subscribe to known ones.
+ * Subscriptions are changed from the async_tcp task and published to from the
+ * publish task, a mutex keeps the lists consistent between the two.
+ */
+class TopicRegistry {
+  public:
+    typedef std::function<void(uint32_t clientId)> Sender;
+
+    TopicRegistry();
+
+    /**
+     * @brief Register a topic clients can subscribe to.
+     *
+     * @param name Topic name, shorter than TOPIC_NAME_MAX.
+     * @return ID of the topic, the existing one if the name is already known, or -1 if there is no room.
+     */
+    int add(const char *name);
+
+    /**
+     * @return ID of the topic called name, or -1 if there is none.
+     */
+    int find(const char *name) const;
+
+    /**
+     * @brief Subscribe a client to a topic, or change its interval if it already is.
+     *
+     * @param client Client to subscribe.
+     * @param topic Topic ID.
+     * @param minIntervalMs Shortest time between two messages to this client on the topic, 0 for all of them.
+     * @return False if the topic is unknown or has no room for another subscriber.
+     */
+    bool subscribe(AsyncWebSocketClient *client, int topic, uint32_t minIntervalMs = 0);
+
+    /**
+     * @return False if the client was not subscribed to the topic.
+     */
+    bool unsubscribe(AsyncWebSocketClient *client, int topic);
+
+    /**
+     * @brief Drop all subscriptions of a client. Must be called before it is deleted.
+     */
+    void remove(AsyncWebSocketClient *client);
+
+    /**
+     * @return Number of clients subscribed to a topic.
+     */
+    size_t subscribers(int topic) const;
+
+    /**
+     * @brief Hand the ID of every subscriber of a topic whose interval has passed to send.
+     *
+     * The IDs are collected under the lock and send runs after it is released,
+     * so it may take other locks and change subscriptions. A client can
+     * disconnect in between, send has to look it up by its ID.
+     *
+     * @param topic Topic ID.
+     * @param now millis() of the message, used for the intervals.
+     * @param send Called once per client due for the message.
+     * @return Number of clients send was called for.
+     */
+    size_t publish(int topic, uint32_t now, const Sender &send);
+
+  private:
+    struct Subscriber {
+      AsyncWebSocketClient *client;
+      uint32_t clientId;
+      uint32_t minIntervalMs;
+      uint32_t lastSent;  // millis() of the last message, valid once sent is set
+      bool sent;
+    };
+
+    struct Topic {
+      char name[TOPIC_NAME_MAX];
+      Subscriber subscribers[MAX_TOPIC_SUBSCRIBERS];
+      uint8_t count;
+    };
+
+    Topic _topics[MAX_TOPICS];
+    uint8_t _topicCount = 0;
+    SemaphoreHandle_t _lock;
+
+    int indexOf(const Topic &topic, AsyncWebSocketClient *client) const;
+    void erase(Topic &topic, int index);
+};
@@ -30,18 +30,74 @@ extern "C"{
 #include "lwip/err.h"
 }
 #include "esp_task_wdt.h"
+#include <atomic>
+#include <new>
 
 /*
  * TCP/IP Event Task
  * */
 
 typedef enum {
-    LWIP_TCP_SENT, LWIP_TCP_RECV, LWIP_TCP_FIN, LWIP_TCP_ERROR, LWIP_TCP_POLL, LWIP_TCP_CLEAR, LWIP_TCP_ACCEPT, LWIP_TCP_CONNECTED, LWIP_TCP_DNS
+    LWIP_TCP_SENT, LWIP_TCP_RECV, LWIP_TCP_FIN, LWIP_TCP_ERROR, LWIP_TCP_POLL, LWIP_TCP_ACCEPT, LWIP_TCP_CONNECTED, LWIP_TCP_DNS
 } lwip_event_t;
 
-typedef struct {
+/*
+ * Event Owners
+ *
+ * Every client has an owner record that outlives it for as long as events refer
+ * to it. Each event copies the owner's generation when it is queued. Clearing the
+ * client's events only bumps the generation, the stale events are then dropped
+ * when they come up instead of being searched for in the queue.
+ * */
+
+struct async_event_owner_t {
+    std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> refs; //the client and every queued event holding it
+    //a slow client gets at most one poll and one sent event in the queue,
+    //later ones are merged into them
+    std::atomic<bool> poll_queued;
+    std::atomic<bool> sent_queued;
+    std::atomic<uint32_t> sent_len; //acked bytes not handed to the client yet
+};
+
+static async_event_owner_t * _new_event_owner(){
+    async_event_owner_t * owner = new (std::nothrow) async_event_owner_t;
+    if(owner){
+        owner->generation.store(0);
+        owner->refs.store(1);
+        owner->poll_queued.store(false);
+        owner->sent_queued.store(false);
+        owner->sent_len.store(0);
+    }
+    return owner;
+}
+
+static void _release_event_owner(async_event_owner_t * owner){
+    if(owner && --owner->refs == 0){
+        delete owner;
+    }
+}
+
+//drops every event queued for the owner so far
+static inline void _clear_events(async_event_owner_t * owner){
+    if(owner){
+        owner->generation++;
+        owner->poll_queued = false;
+        owner->sent_queued = false;
+        owner->sent_len = 0;
+    }
+}
+
+static inline async_event_owner_t * _client_event_owner(void * arg){
+    return arg?reinterpret_cast<AsyncClient*>(arg)->_eventOwner():NULL;
+}
+
+typedef struct lwip_event_packet_t {
         lwip_event_t event;
         void *arg;
+        async_event_owner_t * owner; //NULL for events that do not belong to a client
+        uint32_t generation;
+        lwip_event_packet_t * next; //in the deferred events of its task
         union {
                 struct {
                         void * pcb;
@@ -76,8 +132,102 @@ typedef struct {
         };
 } lwip_event_packet_t;
 
-static xQueueHandle _async_queue;
-static TaskHandle_t _async_service_task_handle = NULL;
+/*
+ * Event Pool
+ *
+ * Events are created in the LwIP thread and freed in the async_tcp task. Taking
+ * them from a fixed pool keeps both off the heap and its lock. The free list is
+ * a stack of pool indexes whose head carries a tag that changes on every update,
+ * so a compare-and-swap never mistakes a reused index for an unchanged list.
+ * */
+
+#define _EVENT_POOL_NONE 0xFFFF
+
+static lwip_event_packet_t _event_pool[CONFIG_ASYNC_TCP_EVENT_POOL_SIZE];
+static std::atomic<uint16_t> _event_pool_next[CONFIG_ASYNC_TCP_EVENT_POOL_SIZE];
+static std::atomic<uint32_t> _event_pool_head(_EVENT_POOL_NONE); //tag << 16 | index of the first free event
+static std::atomic<uint32_t> _event_pool_fallbacks(0);
+static std::atomic<uint32_t> _events_dropped(0);
+static std::atomic<uint32_t> _events_merged(0);
+static std::atomic<uint32_t> _events_deferred(0);
+
+static void _event_pool_push(uint16_t index){
+    uint32_t head = _event_pool_head.load(std::memory_order_relaxed);
+    uint32_t next_head;
+    do {
+        _event_pool_next[index].store(head & 0xFFFF, std::memory_order_relaxed);
+        next_head = ((head + 0x10000) & 0xFFFF0000) | index;
+    } while(!_event_pool_head.compare_exchange_weak(head, next_head, std::memory_order_release, std::memory_order_relaxed));
+}
+
+static bool _init_event_pool(){
+    static_assert(CONFIG_ASYNC_TCP_EVENT_POOL_SIZE > 0 && CONFIG_ASYNC_TCP_EVENT_POOL_SIZE < _EVENT_POOL_NONE, "invalid event pool size");
+    for(int i = CONFIG_ASYNC_TCP_EVENT_POOL_SIZE - 1; i >= 0; i--){
+        _event_pool_push(i);
+    }
+    return true;
+}
+static bool _event_pool_ready = _init_event_pool();
+
+static lwip_event_packet_t * _alloc_event(){
+    uint32_t head = _event_pool_head.load(std::memory_order_acquire);
+    while((head & 0xFFFF) != _EVENT_POOL_NONE){
+        uint16_t index = head & 0xFFFF;
+        uint32_t next_head = ((head + 0x10000) & 0xFFFF0000) | _event_pool_next[index].load(std::memory_order_relaxed);
+        if(_event_pool_head.compare_exchange_weak(head, next_head, std::memory_order_acquire, std::memory_order_acquire)){
+            _event_pool[index].owner = NULL;
+            return &_event_pool[index];
+        }
+    }
+    _event_pool_fallbacks++;
+    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    if(!e){
+        _events_dropped++;
+    } else {
+        e->owner = NULL;
+    }
+    return e;
+}
+
+static void _free_event(lwip_event_packet_t * e){
+    _release_event_owner(e->owner);
+    if(e >= _event_pool && e < _event_pool + CONFIG_ASYNC_TCP_EVENT_POOL_SIZE){
+        _event_pool_push(e - _event_pool);
+    } else {
+        free((void*)(e));
+    }
+}
+
+AsyncTCPStats asyncTcpStats(){
+    AsyncTCPStats stats;
+    stats.eventPoolSize = CONFIG_ASYNC_TCP_EVENT_POOL_SIZE;
+    stats.eventPoolFallbacks = _event_pool_fallbacks.load();
+    stats.eventsDropped = _events_dropped.load();
+    stats.eventsMerged = _events_merged.load();
+    stats.eventsDeferred = _events_deferred.load();
+    return stats;
+}
+
+/*
+ * Event Queue
+ * */
+
+/*
+ * With CONFIG_ASYNC_TCP_TASK_COUNT above 1 every task gets its own queue and a
+ * connection always hashes to the same one, so its events keep their order while
+ * a slow handler only holds up the connections that share its task. Handlers of
+ * different connections can then run at the same time.
+ * */
+
+static xQueueHandle _async_queues[CONFIG_ASYNC_TCP_TASK_COUNT];
+static std::atomic<lwip_event_packet_t *> _deferred_events[CONFIG_ASYNC_TCP_TASK_COUNT]; //newest first
+static TaskHandle_t _async_service_task_handles[CONFIG_ASYNC_TCP_TASK_COUNT];
+
+//the client an event belongs to, an accept is queued with the client it creates
+//so it runs before anything received on that client
+static inline void * _event_client(lwip_event_packet_t * e){
+    return (e->event == LWIP_TCP_ACCEPT)?(void *)(e->accept.client):e->arg;
+}
 
 
 SemaphoreHandle_t _slots_lock;
@@ -93,70 +243,90 @@ static uint32_t _closed_index = []() {
 }();
 
 
-static inline bool _init_async_event_queue(){
-    if(!_async_queue){
-        _async_queue = xQueueCreate(32, sizeof(lwip_event_packet_t *));
-        if(!_async_queue){
+static inline bool _init_async_event_queue(uint8_t shard){
+    if(!_async_queues[shard]){
+        _async_queues[shard] = xQueueCreate(CONFIG_ASYNC_TCP_QUEUE_SIZE, sizeof(lwip_event_packet_t *));
+        if(!_async_queues[shard]){
             return false;
         }
     }
     return true;
 }
 
+//ties an event to the client it is for, called in the LwIP thread while the client is alive
+static inline void _set_event_owner(lwip_event_packet_t * e){
+    if(e->event == LWIP_TCP_ACCEPT || !e->arg || e->owner){
+        return;
+    }
+    e->owner = _client_event_owner(e->arg);
+    if(e->owner){
+        e->owner->refs++;
+        e->generation = e->owner->generation.load();
+    }
+}
+
+/*
+ * The LwIP thread never waits for room in a queue, a slow service task must not
+ * hold up the whole network stack. Events a client can not do without take the
+ * reserve, and when even that is full:
+ *  - fin, error and dns events are deferred, see _defer_async_event()
+ *  - a connect is aborted, the client hears of it as an error
+ *  - an accepted connection is refused
+ * An event is only lost when neither the pool nor the heap has room for it,
+ * which asyncTcpStats() counts as dropped.
+ * */
+
+//slots only fin, error, connect, accept, dns and merged ack events may take
+#define _ASYNC_QUEUE_RESERVE (CONFIG_ASYNC_TCP_QUEUE_SIZE / 4)
+
+//for events the client needs, they may take the reserve
 static inline bool _send_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueSend(_async_queue, e, portMAX_DELAY) == pdPASS;
+    _set_event_owner(*e);
+    xQueueHandle queue = _async_queues[async_tcp_client_shard(_event_client(*e))];
+    return queue && xQueueSend(queue, e, 0) == pdPASS;
 }
 
-static inline bool _prepend_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueSendToFront(_async_queue, e, portMAX_DELAY) == pdPASS;
+//for events LwIP can do without or repeat later, fails instead of waiting for room in the queue.
+//The LwIP thread is the only sender, so the free space can not shrink between check and send.
+static inline bool _try_send_async_event(lwip_event_packet_t ** e){
+    xQueueHandle queue = _async_queues[async_tcp_client_shard(_event_client(*e))];
+    if(!queue || uxQueueSpacesAvailable(queue) <= _ASYNC_QUEUE_RESERVE){
+        return false;
+    }
+    _set_event_owner(*e);
+    return xQueueSend(queue, e, 0) == pdPASS;
 }
 
-static inline bool _get_async_event(lwip_event_packet_t ** e){
-    return _async_queue && xQueueReceive(_async_queue, e, portMAX_DELAY) == pdPASS;
+static inline bool _prepend_async_event(lwip_event_packet_t ** e){
+    _set_event_owner(*e);
+    xQueueHandle queue = _async_queues[async_tcp_client_shard(_event_client(*e))];
+    return queue && xQueueSendToFront(queue, e, 0) == pdPASS;
 }
 
-static bool _remove_events_with_arg(void * arg){
-    lwip_event_packet_t * first_packet = NULL;
-    lwip_event_packet_t * packet = NULL;
+//for an event _send_async_event() found no room for. Only the last event of a client (fin, error) or
+//one it waits for without any other traffic (dns) may be deferred: the task handles it once its queue
+//has run empty, after everything queued before it, so the client still sees its events in order
+static inline void _defer_async_event(lwip_event_packet_t * e){
+    std::atomic<lwip_event_packet_t *> & deferred = _deferred_events[async_tcp_client_shard(_event_client(e))];
+    e->next = deferred.load(std::memory_order_relaxed);
+    while(!deferred.compare_exchange_weak(e->next, e, std::memory_order_release, std::memory_order_relaxed));
+    _events_deferred++;
+}
 
-    if(!_async_queue){
-        return false;
-    }
-    //figure out which is the first packet so we can keep the order
-    while(!first_packet){
-        if(xQueueReceive(_async_queue, &first_packet, 0) != pdPASS){
-            return false;
-        }
-        //discard packet if matching
-        if((int)first_packet->arg == (int)arg){
-            free(first_packet);
-            first_packet = NULL;
-        //return first packet to the back of the queue
-        } else if(xQueueSend(_async_queue, &first_packet, portMAX_DELAY) != pdPASS){
-            return false;
-        }
-    }
+//how long a service task sleeps before it looks for deferred events anyway. The queue was full when
+//they were deferred, so the task is normally busy and finds them as soon as it catches up
+#define _ASYNC_DEFERRED_CHECK_TICKS pdMS_TO_TICKS(100)
 
-    while(xQueuePeek(_async_queue, &packet, 0) == pdPASS && packet != first_packet){
-        if(xQueueReceive(_async_queue, &packet, 0) != pdPASS){
-            return false;
-        }
-        if((int)packet->arg == (int)arg){
-            free(packet);
-            packet = NULL;
-        } else if(xQueueSend(_async_queue, &packet, portMAX_DELAY) != pdPASS){
-            return false;
-        }
-    }
-    return true;
+static inline bool _get_async_event(xQueueHandle queue, lwip_event_packet_t ** e){
+    return queue && xQueueReceive(queue, e, _ASYNC_DEFERRED_CHECK_TICKS) == pdPASS;
 }
 
 static void _handle_async_event(lwip_event_packet_t * e){
     if(e->arg == NULL){
         // do nothing when arg is NULL
         //ets_printf("event arg == NULL: 0x%08x\n", e->recv.pcb);
-    } else if(e->event == LWIP_TCP_CLEAR){
-        _remove_events_with_arg(e->arg);
+    } else if(e->owner && e->generation != e->owner->generation.load()){
+        // the client cleared its events after this one was queued
     } else if(e->event == LWIP_TCP_RECV){
         //ets_printf("-R: 0x%08x\n", e->recv.pcb);
         AsyncClient::_s_recv(e->arg, e->recv.pcb, e->recv.pb, e->recv.err);
@@ -165,9 +335,27 @@ static void _handle_async_event(lwip_event_packet_t * e){
         AsyncClient::_s_fin(e->arg, e->fin.pcb, e->fin.err);
     } else if(e->event == LWIP_TCP_SENT){
         //ets_printf("-S: 0x%08x\n", e->sent.pcb);
-        AsyncClient::_s_sent(e->arg, e->sent.pcb, e->sent.len);
+        uint32_t len = e->sent.len;
+        if(e->owner){
+            //clear the flag first, acks counted after it get an event of their own
+            e->owner->sent_queued = false;
+            len = e->owner->sent_len.exchange(0);
+        }
+        if(len){
+            AsyncClient::_s_sent(e->arg, e->sent.pcb, len);
+        }
     } else if(e->event == LWIP_TCP_POLL){
         //ets_printf("-P: 0x%08x\n", e->poll.pcb);
+        if(e->owner){
+            e->owner->poll_queued = false;
+            //acks whose event could not be queued are delivered here, the poll repeats until they are
+            if(!e->owner->sent_queued){
+                uint32_t len = e->owner->sent_len.exchange(0);
+                if(len){
+                    AsyncClient::_s_sent(e->arg, e->poll.pcb, len);
+                }
+            }
+        }
         AsyncClient::_s_poll(e->arg, e->poll.pcb);
     } else if(e->event == LWIP_TCP_ERROR){
         //ets_printf("-E: 0x%08x %d\n", e->arg, e->error.err);
@@ -182,13 +370,31 @@ static void _handle_async_event(lwip_event_packet_t * e){
         //ets_printf("D: 0x%08x %s = %s\n", e->arg, e->dns.name, ipaddr_ntoa(&e->dns.addr));
         AsyncClient::_s_dns_found(e->dns.name, &e->dns.addr, e->arg);
     }
-    free((void*)(e));
+    _free_event(e);
+}
+
+static void _handle_deferred_events(uint8_t shard){
+    lwip_event_packet_t * e = _deferred_events[shard].exchange(NULL, std::memory_order_acquire);
+    lwip_event_packet_t * oldest = NULL;
+    while(e){
+        lwip_event_packet_t * next = e->next;
+        e->next = oldest;
+        oldest = e;
+        e = next;
+    }
+    while(oldest){
+        lwip_event_packet_t * next = oldest->next;
+        _handle_async_event(oldest);
+        oldest = next;
+    }
 }
 
 static void _async_service_task(void *pvParameters){
+    uint8_t shard = (uint8_t)(uintptr_t)pvParameters;
+    xQueueHandle queue = _async_queues[shard];
     lwip_event_packet_t * packet = NULL;
     for (;;) {
-        if(_get_async_event(&packet)){
+        if(_get_async_event(queue, &packet)){
 #if CONFIG_ASYNC_TCP_USE_WDT
             if(esp_task_wdt_add(NULL) != ESP_OK){
                 log_e("Failed to add async task to WDT");
@@ -201,25 +407,43 @@ static void _async_service_task(void *pvParameters){
             }
 #endif
         }
+        if(!uxQueueMessagesWaiting(queue)){
+            _handle_deferred_events(shard);
+        }
     }
     vTaskDelete(NULL);
-    _async_service_task_handle = NULL;
+    _async_service_task_handles[shard] = NULL;
 }
 /*
 static void _stop_async_task(){
-    if(_async_service_task_handle){
-        vTaskDelete(_async_service_task_handle);
-        _async_service_task_handle = NULL;
+    for(uint8_t i = 0; i < CONFIG_ASYNC_TCP_TASK_COUNT; i++){
+        if(_async_service_task_handles[i]){
+            vTaskDelete(_async_service_task_handles[i]);
+            _async_service_task_handles[i] = NULL;
+        }
     }
 }
 */
 static bool _start_async_task(){
-    if(!_init_async_event_queue()){
-        return false;
+    for(uint8_t i = 0; i < CONFIG_ASYNC_TCP_TASK_COUNT; i++){
+        if(!_init_async_event_queue(i)){
+            return false;
+        }
     }
-    if(!_async_service_task_handle){
-        xTaskCreateUniversal(_async_service_task, "async_tcp", 8192 * 2, NULL, 3, &_async_service_task_handle, CONFIG_ASYNC_TCP_RUNNING_CORE);
-        if(!_async_service_task_handle){
+    for(uint8_t i = 0; i < CONFIG_ASYNC_TCP_TASK_COUNT; i++){
+        if(_async_service_task_handles[i]){
+            continue;
+        }
+#if CONFIG_ASYNC_TCP_TASK_COUNT > 1
+        char name[16];
+        snprintf(name, sizeof(name), "async_tcp%u", i);
+        //without a configured core the tasks are spread over all of them
+        int core = (CONFIG_ASYNC_TCP_RUNNING_CORE < 0)?(i % portNUM_PROCESSORS):CONFIG_ASYNC_TCP_RUNNING_CORE;
+        xTaskCreateUniversal(_async_service_task, name, 8192 * 2, (void *)(uintptr_t)i, 3, &_async_service_task_handles[i], core);
+#else
+        xTaskCreateUniversal(_async_service_task, "async_tcp", 8192 * 2, NULL, 3, &_async_service_task_handles[i], CONFIG_ASYNC_TCP_RUNNING_CORE);
+#endif
+        if(!_async_service_task_handles[i]){
             return false;
         }
     }
@@ -230,43 +454,60 @@ static bool _start_async_task(){
  * LwIP Callbacks
  * */
 
-static int8_t _tcp_clear_events(void * arg) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
-    e->event = LWIP_TCP_CLEAR;
-    e->arg = arg;
-    if (!_prepend_async_event(&e)) {
-        free((void*)(e));
-    }
-    return ERR_OK;
-}
-
 static int8_t _tcp_connected(void * arg, tcp_pcb * pcb, int8_t err) {
     //ets_printf("+C: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
-    e->event = LWIP_TCP_CONNECTED;
-    e->arg = arg;
-    e->connected.pcb = pcb;
-    e->connected.err = err;
-    if (!_prepend_async_event(&e)) {
-        free((void*)(e));
+    lwip_event_packet_t * e = _alloc_event();
+    if(e){
+        e->event = LWIP_TCP_CONNECTED;
+        e->arg = arg;
+        e->connected.pcb = pcb;
+        e->connected.err = err;
+        if (_prepend_async_event(&e)) {
+            return ERR_OK;
+        }
+        _free_event(e);
     }
-    return ERR_OK;
+    //the client would never hear of the connection, it gets the error of the abort instead
+    tcp_abort(pcb);
+    return ERR_ABRT;
 }
 
 static int8_t _tcp_poll(void * arg, struct tcp_pcb * pcb) {
     //ets_printf("+P: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    async_event_owner_t * owner = _client_event_owner(arg);
+    if(owner && owner->poll_queued.exchange(true)){
+        _events_merged++;
+        return ERR_OK;
+    }
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        if(owner){
+            owner->poll_queued = false;
+        }
+        return ERR_OK;
+    }
     e->event = LWIP_TCP_POLL;
     e->arg = arg;
     e->poll.pcb = pcb;
-    if (!_send_async_event(&e)) {
-        free((void*)(e));
+    //the next poll comes soon enough, skip this one if the queue is full
+    if (!_try_send_async_event(&e)) {
+        _events_dropped++;
+        _free_event(e);
+        if(owner){
+            owner->poll_queued = false;
+        }
     }
     return ERR_OK;
 }
 
 static int8_t _tcp_recv(void * arg, struct tcp_pcb * pcb, struct pbuf *pb, int8_t err) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        if(pb){
+            return ERR_MEM; //LwIP keeps the data and delivers it again later
+        }
+        return AsyncClient::_s_lwip_fin(arg, pcb, err);
+    }
     e->arg = arg;
     if(pb){
         //ets_printf("+R: 0x%08x\n", pcb);
@@ -274,46 +515,78 @@ static int8_t _tcp_recv(void * arg, struct tcp_pcb * pcb, struct pbuf *pb, int8_
         e->recv.pcb = pcb;
         e->recv.pb = pb;
         e->recv.err = err;
-    } else {
-        //ets_printf("+F: 0x%08x\n", pcb);
-        e->event = LWIP_TCP_FIN;
-        e->fin.pcb = pcb;
-        e->fin.err = err;
-        //close the PCB in LwIP thread
-        AsyncClient::_s_lwip_fin(e->arg, e->fin.pcb, e->fin.err);
+        if (!_try_send_async_event(&e)) {
+            _free_event(e);
+            return ERR_MEM; //LwIP keeps the data and delivers it again later
+        }
+        return ERR_OK;
     }
+    //ets_printf("+F: 0x%08x\n", pcb);
+    e->event = LWIP_TCP_FIN;
+    e->fin.pcb = pcb;
+    e->fin.err = err;
+    //close the PCB in LwIP thread
+    int8_t result = AsyncClient::_s_lwip_fin(e->arg, e->fin.pcb, e->fin.err);
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _defer_async_event(e);
     }
-    return ERR_OK;
+    return result;
 }
 
 static int8_t _tcp_sent(void * arg, struct tcp_pcb * pcb, uint16_t len) {
     //ets_printf("+S: 0x%08x\n", pcb);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    async_event_owner_t * owner = _client_event_owner(arg);
+    if(owner){
+        //count the bytes before looking at the flag, the event being handled may take them
+        owner->sent_len += len;
+        if(owner->sent_queued.exchange(true)){
+            _events_merged++;
+            return ERR_OK;
+        }
+    }
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        if(owner){
+            owner->sent_queued = false; //the bytes stay counted for the next ack or poll
+        }
+        return ERR_OK;
+    }
     e->event = LWIP_TCP_SENT;
     e->arg = arg;
     e->sent.pcb = pcb;
     e->sent.len = len;
-    if (!_send_async_event(&e)) {
-        free((void*)(e));
+    //without the ack a response or WebSocket queue waiting for window space stalls, so it gets the reserve
+    bool queued = owner ? _send_async_event(&e) : _try_send_async_event(&e);
+    if (!queued) {
+        _free_event(e);
+        if(owner){
+            owner->sent_queued = false;
+        } else {
+            _events_dropped++;
+        }
     }
     return ERR_OK;
 }
 
 static void _tcp_error(void * arg, int8_t err) {
     //ets_printf("+E: 0x%08x\n", arg);
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        return;
+    }
     e->event = LWIP_TCP_ERROR;
     e->arg = arg;
     e->error.err = err;
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _defer_async_event(e);
     }
 }
 
 static void _tcp_dns_found(const char * name, struct ip_addr * ipaddr, void * arg) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        return;
+    }
     //ets_printf("+DNS: name=%s ipaddr=0x%08x arg=%x\n", name, ipaddr, arg);
     e->event = LWIP_TCP_DNS;
     e->arg = arg;
@@ -324,18 +597,22 @@ static void _tcp_dns_found(const char * name, struct ip_addr * ipaddr, void * ar
         memset(&e->dns.addr, 0, sizeof(e->dns.addr));
     }
     if (!_send_async_event(&e)) {
-        free((void*)(e));
+        _defer_async_event(e);
     }
 }
 
 //Used to switch out from LwIP thread
 static int8_t _tcp_accept(void * arg, AsyncClient * client) {
-    lwip_event_packet_t * e = (lwip_event_packet_t *)malloc(sizeof(lwip_event_packet_t));
+    lwip_event_packet_t * e = _alloc_event();
+    if(!e){
+        return ERR_MEM;
+    }
     e->event = LWIP_TCP_ACCEPT;
     e->arg = arg;
     e->accept.client = client;
     if (!_prepend_async_event(&e)) {
-        free((void*)(e));
+        _free_event(e);
+        return ERR_MEM;
     }
     return ERR_OK;
 }
@@ -356,7 +633,14 @@ typedef struct {
                     const char* data;
                     size_t size;
                     uint8_t apiflags;
+                    uint32_t * ref_end;
             } write;
+            struct {
+                    const AsyncTxSegment * segments;
+                    size_t count;
+                    size_t written;
+                    uint32_t * ref_end;
+            } writev;
             size_t received;
             struct {
                     ip_addr_t * addr;
@@ -396,11 +680,15 @@ static err_t _tcp_write_api(struct tcpip_api_call_data *api_call_msg){
     msg->err = ERR_CONN;
     if(msg->closed_slot == -1 || !_closed_slots[msg->closed_slot]) {
         msg->err = tcp_write(msg->pcb, msg->write.data, msg->write.size, msg->write.apiflags);
+        if(msg->err == ERR_OK && !(msg->write.apiflags & TCP_WRITE_FLAG_COPY)){
+            *msg->write.ref_end = msg->pcb->snd_lbb;
+        }
     }
     return msg->err;
 }
 
-static esp_err_t _tcp_write(tcp_pcb * pcb, int8_t closed_slot, const char* data, size_t size, uint8_t apiflags) {
+//ref_end is set to the sequence number after the data if it is referenced rather than copied
+static esp_err_t _tcp_write(tcp_pcb * pcb, int8_t closed_slot, const char* data, size_t size, uint8_t apiflags, uint32_t * ref_end) {
     if(!pcb){
         return ERR_CONN;
     }
@@ -410,10 +698,65 @@ static esp_err_t _tcp_write(tcp_pcb * pcb, int8_t closed_slot, const char* data,
     msg.write.data = data;
     msg.write.size = size;
     msg.write.apiflags = apiflags;
+    msg.write.ref_end = ref_end;
     tcpip_api_call(_tcp_write_api, (struct tcpip_api_call_data*)&msg);
     return msg.err;
 }
 
+//queues as many segments as the send buffer takes and sends them, all in one visit to the LwIP thread
+static err_t _tcp_writev_api(struct tcpip_api_call_data *api_call_msg){
+    tcp_api_call_t * msg = (tcp_api_call_t *)api_call_msg;
+    msg->err = ERR_CONN;
+    msg->writev.written = 0;
+    if(msg->closed_slot == -1 || !_closed_slots[msg->closed_slot]) {
+        msg->err = ERR_OK;
+        for(size_t i = 0; i < msg->writev.count; i++){
+            const AsyncTxSegment * segment = &msg->writev.segments[i];
+            size_t room = tcp_sndbuf(msg->pcb);
+            size_t size = (room < segment->len) ? room : segment->len;
+            if(!size){
+                break;
+            }
+            //only the last byte gets the PSH flag
+            uint8_t apiflags = segment->apiflags;
+            if(size < segment->len || i + 1 < msg->writev.count){
+                apiflags |= TCP_WRITE_FLAG_MORE;
+            }
+            msg->err = tcp_write(msg->pcb, segment->data, size, apiflags);
+            if(msg->err != ERR_OK){
+                break;
+            }
+            msg->writev.written += size;
+            if(!(segment->apiflags & TCP_WRITE_FLAG_COPY)){
+                *msg->writev.ref_end = msg->pcb->snd_lbb;
+            }
+            if(size < segment->len){
+                break;
+            }
+        }
+        if(msg->writev.written){
+            msg->err = tcp_output(msg->pcb);
+        }
+    }
+    return msg->err;
+}
+
+static esp_err_t _tcp_writev(tcp_pcb * pcb, int8_t closed_slot, const AsyncTxSegment * segments, size_t count, size_t * written, uint32_t * ref_end) {
+    *written = 0;
+    if(!pcb){
+        return ERR_CONN;
+    }
+    tcp_api_call_t msg;
+    msg.pcb = pcb;
+    msg.closed_slot = closed_slot;
+    msg.writev.segments = segments;
+    msg.writev.count = count;
+    msg.writev.ref_end = ref_end;
+    tcpip_api_call(_tcp_writev_api, (struct tcpip_api_call_data*)&msg);
+    *written = msg.writev.written;
+    return msg.err;
+}
+
 static err_t _tcp_recved_api(struct tcpip_api_call_data *api_call_msg){
     tcp_api_call_t * msg = (tcp_api_call_t *)api_call_msg;
     msg->err = ERR_CONN;
@@ -553,11 +896,16 @@ AsyncClient::AsyncClient(tcp_pcb* pcb)
 , _recv_cb_arg(0)
 , _pb_cb(0)
 , _pb_cb_arg(0)
+, _segments_cb(0)
+, _segments_cb_arg(0)
 , _timeout_cb(0)
 , _timeout_cb_arg(0)
 , _pcb_busy(false)
 , _pcb_sent_at(0)
 , _ack_pcb(true)
+, _rx_ack_len(0)
+, _tx_refs(false)
+, _tx_ref_end(0)
 , _rx_last_packet(0)
 , _rx_since_timeout(0)
 , _ack_timeout(ASYNC_MAX_ACK_TIME)
@@ -567,6 +915,7 @@ AsyncClient::AsyncClient(tcp_pcb* pcb)
 {
     _pcb = pcb;
     _closed_slot = -1;
+    _event_owner = _new_event_owner();
     if(_pcb){
         _allocate_closed_slot();
         _rx_last_packet = millis();
@@ -583,6 +932,9 @@ AsyncClient::~AsyncClient(){
         _close();
     }
     _free_closed_slot();
+    //events still queued for this client must not reach it anymore
+    _clear_events(_event_owner);
+    _release_event_owner(_event_owner);
 }
 
 /*
@@ -660,6 +1012,11 @@ void AsyncClient::onPacket(AcPacketHandler cb, void* arg){
   _pb_cb_arg = arg;
 }
 
+void AsyncClient::onSegments(AcSegmentsHandler cb, void* arg){
+    _segments_cb = cb;
+    _segments_cb_arg = arg;
+}
+
 void AsyncClient::onTimeout(AcTimeoutHandler cb, void* arg){
     _timeout_cb = cb;
     _timeout_cb_arg = arg;
@@ -755,10 +1112,13 @@ size_t AsyncClient::add(const char* data, size_t size, uint8_t apiflags) {
     }
     size_t will_send = (room < size) ? room : size;
     int8_t err = ERR_OK;
-    err = _tcp_write(_pcb, _closed_slot, data, will_send, apiflags);
+    err = _tcp_write(_pcb, _closed_slot, data, will_send, apiflags, &_tx_ref_end);
     if(err != ERR_OK) {
         return 0;
     }
+    if(!(apiflags & ASYNC_WRITE_FLAG_COPY)) {
+        _tx_refs = true;
+    }
     return will_send;
 }
 
@@ -773,6 +1133,23 @@ bool AsyncClient::send(){
     return false;
 }
 
+size_t AsyncClient::writev(const AsyncTxSegment* segments, size_t count) {
+    if(!_pcb || !count || segments == NULL || !space()) {
+        return 0;
+    }
+    size_t written = 0;
+    if(_tcp_writev(_pcb, _closed_slot, segments, count, &written, &_tx_ref_end) == ERR_OK && written){
+        for(size_t i = 0; i < count; i++){
+            if(!(segments[i].apiflags & ASYNC_WRITE_FLAG_COPY)){
+                _tx_refs = true;
+            }
+        }
+        _pcb_busy = true;
+        _pcb_sent_at = millis();
+    }
+    return written;
+}
+
 size_t AsyncClient::ack(size_t len){
     if(len > _rx_ack_len)
         len = _rx_ack_len;
@@ -805,10 +1182,15 @@ int8_t AsyncClient::_close(){
         tcp_recv(_pcb, NULL);
         tcp_err(_pcb, NULL);
         tcp_poll(_pcb, NULL, 0);
-        _tcp_clear_events(this);
-        err = _tcp_close(_pcb, _closed_slot);
-        if(err != ERR_OK) {
+        _clear_events(_event_owner);
+        if(_tx_refs_pending()) {
+            //LwIP would keep sending data the owner frees once it is told the connection is gone
             err = abort();
+        } else {
+            err = _tcp_close(_pcb, _closed_slot);
+            if(err != ERR_OK) {
+                err = abort();
+            }
         }
         _pcb = NULL;
         if(_discard_cb) {
@@ -892,24 +1274,46 @@ int8_t AsyncClient::_lwip_fin(tcp_pcb* pcb, int8_t err) {
         tcp_err(_pcb, NULL);
         tcp_poll(_pcb, NULL, 0);
     }
-    if(tcp_close(_pcb) != ERR_OK) {
+    //the client is discarded next, referenced data must not outlive it in the send queue
+    int8_t result = ERR_OK;
+    if(_tx_refs_pending() || tcp_close(_pcb) != ERR_OK) {
+        tcp_err(_pcb, NULL);
         tcp_abort(_pcb);
+        result = ERR_ABRT;
     }
     _free_closed_slot();
     _pcb = NULL;
-    return ERR_OK;
+    return result;
+}
+
+//In LwIP Thread: lets go of a PCB LwIP is about to abort, without any call to it or event for it
+void AsyncClient::_detach_pcb(){
+    if(_pcb){
+        tcp_arg(_pcb, NULL);
+        tcp_sent(_pcb, NULL);
+        tcp_recv(_pcb, NULL);
+        tcp_err(_pcb, NULL);
+        tcp_poll(_pcb, NULL, 0);
+        _pcb = NULL;
+    }
+}
+
+//data queued without ASYNC_WRITE_FLAG_COPY that the peer has not acked yet. Outside the LwIP
+//thread the ack can be stale, which only makes a close abort when it did not have to
+bool AsyncClient::_tx_refs_pending(){
+    return _tx_refs && (int32_t)(_pcb->lastack - _tx_ref_end) < 0;
 }
 
 //In Async Thread
 int8_t AsyncClient::_fin(tcp_pcb* pcb, int8_t err) {
-    _tcp_clear_events(this);
+    _clear_events(_event_owner);
     if(_discard_cb) {
         _discard_cb(_discard_cb_arg, this);
     }
     return ERR_OK;
 }
 
-int8_t AsyncClient::_sent(tcp_pcb* pcb, uint16_t len) {
+int8_t AsyncClient::_sent(tcp_pcb* pcb, uint32_t len) {
     _rx_last_packet = millis();
     //log_i("%u", len);
     _pcb_busy = false;
@@ -920,6 +1324,10 @@ int8_t AsyncClient::_sent(tcp_pcb* pcb, uint16_t len) {
 }
 
 int8_t AsyncClient::_recv(tcp_pcb* pcb, pbuf* pb, int8_t err) {
+    if(_segments_cb && !_pb_cb){
+        _recv_segments(pb);
+        return ERR_OK;
+    }
     while(pb != NULL) {
         _rx_last_packet = millis();
         //we should not ack before we assimilate the data
@@ -944,6 +1352,36 @@ int8_t AsyncClient::_recv(tcp_pcb* pcb, pbuf* pb, int8_t err) {
     return ERR_OK;
 }
 
+//hands the chain to onSegments up to ASYNC_MAX_RX_SEGMENTS pbufs at a time, acking each batch with one call
+void AsyncClient::_recv_segments(pbuf* pb){
+    AsyncRxSegment segments[ASYNC_MAX_RX_SEGMENTS];
+    while(pb != NULL) {
+        _rx_last_packet = millis();
+        size_t count = 0;
+        size_t len = 0;
+        pbuf *last = pb;
+        for(pbuf *b = pb; b != NULL && count < ASYNC_MAX_RX_SEGMENTS; b = b->next){
+            segments[count].data = (uint8_t*)b->payload;
+            segments[count].len = b->len;
+            len += b->len;
+            count++;
+            last = b;
+        }
+        pbuf *rest = last->next;
+        last->next = NULL;
+        //we should not ack before we assimilate the data
+        _ack_pcb = true;
+        _segments_cb(_segments_cb_arg, this, segments, count);
+        if(!_ack_pcb) {
+            _rx_ack_len += len;
+        } else if(_pcb) {
+            _tcp_recved(_pcb, _closed_slot, len);
+        }
+        pbuf_free(pb);
+        pb = rest;
+    }
+}
+
 int8_t AsyncClient::_poll(tcp_pcb* pcb){
     if(!_pcb){
         log_w("pcb is NULL");
@@ -1218,7 +1656,7 @@ int8_t AsyncClient::_s_lwip_fin(void * arg, struct tcp_pcb * pcb, int8_t err) {
     return reinterpret_cast<AsyncClient*>(arg)->_lwip_fin(pcb, err);
 }
 
-int8_t AsyncClient::_s_sent(void * arg, struct tcp_pcb * pcb, uint16_t len) {
+int8_t AsyncClient::_s_sent(void * arg, struct tcp_pcb * pcb, uint32_t len) {
     return reinterpret_cast<AsyncClient*>(arg)->_sent(pcb, len);
 }
 
@@ -1316,7 +1754,13 @@ int8_t AsyncServer::_accept(tcp_pcb* pcb, int8_t err){
         AsyncClient *c = new AsyncClient(pcb);
         if(c){
             c->setNoDelay(_noDelay);
-            return _tcp_accept(this, c);
+            int8_t err = _tcp_accept(this, c);
+            if(err != ERR_OK){
+                //the server can not be told, LwIP aborts the connection on the error
+                c->_detach_pcb();
+                delete c;
+            }
+            return err;
         }
     }
     if(tcp_close(pcb) != ERR_OK){
@@ -36,21 +36,58 @@ extern "C" {
 #define CONFIG_ASYNC_TCP_USE_WDT 1 //if enabled, adds between 33us and 200us per event
 #endif
 
+#ifndef CONFIG_ASYNC_TCP_QUEUE_SIZE
+#define CONFIG_ASYNC_TCP_QUEUE_SIZE 32 //LwIP events waiting for the async_tcp task
+#endif
+
+#include "AsyncTCPShard.h" //CONFIG_ASYNC_TCP_TASK_COUNT
+
+#ifndef CONFIG_ASYNC_TCP_EVENT_POOL_SIZE
+#define CONFIG_ASYNC_TCP_EVENT_POOL_SIZE (CONFIG_ASYNC_TCP_QUEUE_SIZE * CONFIG_ASYNC_TCP_TASK_COUNT + 8) //preallocated events, the heap is used beyond this
+#endif
+
 class AsyncClient;
 
 #define ASYNC_MAX_ACK_TIME 5000
 #define ASYNC_WRITE_FLAG_COPY 0x01 //will allocate new buffer to hold the data while sending (else will hold reference to the data given)
 #define ASYNC_WRITE_FLAG_MORE 0x02 //will not send PSH flag, meaning that there should be more data to be sent before the application should react.
+#define ASYNC_MAX_RX_SEGMENTS 8 //pbufs handed to onSegments at once, longer chains take more calls
+
+//one piece of data for writev(). Without ASYNC_WRITE_FLAG_COPY the data must stay valid until it is acked
+//or the client is discarded, closing a connection with such data unacked aborts it
+struct AsyncTxSegment {
+    const char * data;
+    size_t len;
+    uint8_t apiflags;
+};
+
+//one pbuf of a received packet, the data may be changed in place but is freed once the handler returns
+struct AsyncRxSegment {
+    uint8_t * data;
+    size_t len;
+};
 
 typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
 typedef std::function<void(void*, AsyncClient*, size_t len, uint32_t time)> AcAckHandler;
 typedef std::function<void(void*, AsyncClient*, int8_t error)> AcErrorHandler;
 typedef std::function<void(void*, AsyncClient*, void *data, size_t len)> AcDataHandler;
 typedef std::function<void(void*, AsyncClient*, struct pbuf *pb)> AcPacketHandler;
+typedef std::function<void(void*, AsyncClient*, AsyncRxSegment *segments, size_t count)> AcSegmentsHandler;
 typedef std::function<void(void*, AsyncClient*, uint32_t time)> AcTimeoutHandler;
 
 struct tcp_pcb;
 struct ip_addr;
+struct async_event_owner_t;
+
+struct AsyncTCPStats {
+    uint32_t eventPoolSize;      //events preallocated for the LwIP callbacks
+    uint32_t eventPoolFallbacks; //events taken from the heap because the pool was empty
+    uint32_t eventsDropped;      //events lost because the heap was empty too, or polls skipped on a full queue
+    uint32_t eventsMerged;       //polls and acks folded into an event already queued for the same client
+    uint32_t eventsDeferred;     //fin, error and dns events handled after the queue ran empty because it was full
+};
+
+AsyncTCPStats asyncTcpStats();
 
 class AsyncClient {
   public:
@@ -80,6 +117,9 @@ class AsyncClient {
     //write equals add()+send()
     size_t write(const char* data);
     size_t write(const char* data, size_t size, uint8_t apiflags=ASYNC_WRITE_FLAG_COPY); //only when canSend() == true
+    //adds the segments in order and sends them with a single call into the LwIP thread.
+    //Stops where the send buffer is full, returns the number of bytes taken
+    size_t writev(const AsyncTxSegment* segments, size_t count);
 
     uint8_t state();
     bool connecting();
@@ -116,12 +156,13 @@ class AsyncClient {
     void onError(AcErrorHandler cb, void* arg = 0);         //unsuccessful connect or error
     void onData(AcDataHandler cb, void* arg = 0);           //data received (called if onPacket is not used)
     void onPacket(AcPacketHandler cb, void* arg = 0);       //data received
+    void onSegments(AcSegmentsHandler cb, void* arg = 0);   //data received as the pbufs of a packet, acked as a whole (if onPacket is not used, replaces onData)
     void onTimeout(AcTimeoutHandler cb, void* arg = 0);     //ack timeout
     void onPoll(AcConnectHandler cb, void* arg = 0);        //every 125ms when connected
 
     void ackPacket(struct pbuf * pb);//ack pbuf from onPacket
     size_t ack(size_t len); //ack data that you have not acked using the method below
-    void ackLater(){ _ack_pcb = false; } //will not ack the current packet. Call from onData
+    void ackLater(){ _ack_pcb = false; } //will not ack the current packet, the TCP window stays smaller until ack(). Call from onData or onSegments
 
     const char * errorToString(int8_t error);
     const char * stateToString();
@@ -132,16 +173,19 @@ class AsyncClient {
     static int8_t _s_fin(void *arg, struct tcp_pcb *tpcb, int8_t err);
     static int8_t _s_lwip_fin(void *arg, struct tcp_pcb *tpcb, int8_t err);
     static void _s_error(void *arg, int8_t err);
-    static int8_t _s_sent(void *arg, struct tcp_pcb *tpcb, uint16_t len);
+    static int8_t _s_sent(void *arg, struct tcp_pcb *tpcb, uint32_t len);
     static int8_t _s_connected(void* arg, void* tpcb, int8_t err);
     static void _s_dns_found(const char *name, struct ip_addr *ipaddr, void *arg);
 
     int8_t _recv(tcp_pcb* pcb, pbuf* pb, int8_t err);
     tcp_pcb * pcb(){ return _pcb; }
+    async_event_owner_t * _eventOwner(){ return _event_owner; }
+    void _detach_pcb();
 
   protected:
     tcp_pcb* _pcb;
     int8_t  _closed_slot;
+    async_event_owner_t * _event_owner;
 
     AcConnectHandler _connect_cb;
     void* _connect_cb_arg;
@@ -155,6 +199,8 @@ class AsyncClient {
     void* _recv_cb_arg;
     AcPacketHandler _pb_cb;
     void* _pb_cb_arg;
+    AcSegmentsHandler _segments_cb;
+    void* _segments_cb_arg;
     AcTimeoutHandler _timeout_cb;
     void* _timeout_cb_arg;
     AcConnectHandler _poll_cb;
@@ -164,6 +210,8 @@ class AsyncClient {
     uint32_t _pcb_sent_at;
     bool _ack_pcb;
     uint32_t _rx_ack_len;
+    bool _tx_refs; //data was queued without ASYNC_WRITE_FLAG_COPY
+    uint32_t _tx_ref_end; //sequence number after the last referenced byte
     uint32_t _rx_last_packet;
     uint32_t _rx_since_timeout;
     uint32_t _ack_timeout;
@@ -175,9 +223,11 @@ class AsyncClient {
     int8_t _connected(void* pcb, int8_t err);
     void _error(int8_t err);
     int8_t _poll(tcp_pcb* pcb);
-    int8_t _sent(tcp_pcb* pcb, uint16_t len);
+    int8_t _sent(tcp_pcb* pcb, uint32_t len);
     int8_t _fin(tcp_pcb* pcb, int8_t err);
     int8_t _lwip_fin(tcp_pcb* pcb, int8_t err);
+    bool _tx_refs_pending();
+    void _recv_segments(pbuf* pb);
     void _dns_found(struct ip_addr *ipaddr);
 
   public:
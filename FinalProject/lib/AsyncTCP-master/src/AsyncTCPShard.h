@@ -0,0 +1,43 @@
+/*
+  Asynchronous TCP library for Espressif MCUs
+
+  Copyright (c) 2016 Hristo Gochkov. All rights reserved.
+  This file is part of the esp8266 core for Arduino environment.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ASYNCTCPSHARD_H_
+#define ASYNCTCPSHARD_H_
+
+#include <stdint.h>
+
+#ifndef CONFIG_ASYNC_TCP_TASK_COUNT
+#define CONFIG_ASYNC_TCP_TASK_COUNT 1 //async_tcp tasks, each with its own queue, connections are split between them
+#endif
+
+//the async_tcp task that handles every event of a client. Kept apart from
+//AsyncTCP.cpp so the split can be checked without LwIP.
+static inline uint8_t async_tcp_client_shard(const void * client){
+#if CONFIG_ASYNC_TCP_TASK_COUNT > 1
+    //heap addresses differ mostly in the middle bits, spread them with a multiplicative hash
+    return (((uint32_t)(uintptr_t)client * 2654435761u) >> 16) % CONFIG_ASYNC_TCP_TASK_COUNT;
+#else
+    (void)client;
+    return 0;
+#endif
+}
+
+#endif /* ASYNCTCPSHARD_H_ */
@@ -40,6 +40,28 @@ size_t webSocketSendFrameWindow(AsyncClient *client){
   return space - 8;
 }
 
+//writes a frame header to buf, WS_MAX_HEADER_LEN + 4 bytes when masked
+static uint8_t webSocketFrameHeader(uint8_t *buf, bool final, uint8_t opcode, bool mask, size_t len, const uint8_t *mbuf){
+  uint8_t headLen = 2;
+  buf[0] = opcode & 0x0F;
+  if(final)
+    buf[0] |= 0x80;
+  if(len < 126)
+    buf[1] = len & 0x7F;
+  else {
+    buf[1] = 126;
+    buf[2] = (uint8_t)((len >> 8) & 0xFF);
+    buf[3] = (uint8_t)(len & 0xFF);
+    headLen += 2;
+  }
+  if(len && mask){
+    buf[1] |= 0x80;
+    memcpy(buf + headLen, mbuf, 4);
+    headLen += 4;
+  }
+  return headLen;
+}
+
 size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool mask, uint8_t *data, size_t len){
   if(!client->canSend())
     return 0;
@@ -63,45 +85,20 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
 
   if(len > space) len = space;
 
-  uint8_t *buf = (uint8_t*)malloc(headLen);
-  if(buf == NULL){
-    //os_printf("could not malloc %u bytes for frame header\n", headLen);
-    return 0;
-  }
+  uint8_t buf[WS_MAX_HEADER_LEN + 4];
+  headLen = webSocketFrameHeader(buf, final, opcode, mask, len, mbuf);
 
-  buf[0] = opcode & 0x0F;
-  if(final)
-    buf[0] |= 0x80;
-  if(len < 126)
-    buf[1] = len & 0x7F;
-  else {
-    buf[1] = 126;
-    buf[2] = (uint8_t)((len >> 8) & 0xFF);
-    buf[3] = (uint8_t)(len & 0xFF);
-  }
   if(len && mask){
-    buf[1] |= 0x80;
-    memcpy(buf + (headLen - 4), mbuf, 4);
-  }
-  if(client->add((const char *)buf, headLen) != headLen){
-    //os_printf("error adding %lu header bytes\n", headLen);
-    free(buf);
-    return 0;
-  }
-  free(buf);
-
-  if(len){
-    if(len && mask){
-      size_t i;
-      for(i=0;i<len;i++)
-        data[i] = data[i] ^ mbuf[i%4];
-    }
-    if(client->add((const char *)data, len) != len){
-      //os_printf("error adding %lu data bytes\n", len);
-      return 0;
-    }
-  }
-  if(!client->send()){
+    size_t i;
+    for(i=0;i<len;i++)
+      data[i] = data[i] ^ mbuf[i%4];
+  }
+  //the payload is copied too, a closing connection can still send it after the message is gone
+  AsyncTxSegment segments[2] = {
+    {(const char *)buf, headLen, ASYNC_WRITE_FLAG_COPY},
+    {(const char *)data, len, ASYNC_WRITE_FLAG_COPY}
+  };
+  if(client->writev(segments, len ? 2 : 1) != headLen + len){
     //os_printf("error sending frame: %lu\n", headLen+len);
     return 0;
   }
@@ -116,112 +113,147 @@ size_t webSocketSendFrame(AsyncClient *client, bool final, uint8_t opcode, bool
 
 
 AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer()
-  :_data(nullptr)
+  :_frame(nullptr)
+  ,_data(nullptr)
   ,_len(0)
   ,_lock(false)
   ,_count(0)
+  ,_headerOpcode(WS_CONTINUATION)
+  ,_headerLen(0)
 {
 
 }
 
 AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer(uint8_t * data, size_t size) 
-  :_data(nullptr)
+  :_frame(nullptr)
+  ,_data(nullptr)
   ,_len(size)
   ,_lock(false)
   ,_count(0)
+  ,_headerOpcode(WS_CONTINUATION)
+  ,_headerLen(0)
 {
 
   if (!data) {
     return; 
   }
 
-  _data = new uint8_t[_len + 1];
-
-  if (_data) {
+  if (_allocate(_len)) {
     memcpy(_data, data, _len);
-    _data[_len] = 0; 
   }
 }
 
 
 AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer(size_t size)
-  :_data(nullptr)
+  :_frame(nullptr)
+  ,_data(nullptr)
   ,_len(size)
   ,_lock(false)
   ,_count(0)
+  ,_headerOpcode(WS_CONTINUATION)
+  ,_headerLen(0)
 {
-  _data = new uint8_t[_len + 1]; 
-
-  if (_data) {
-    _data[_len] = 0; 
-  }
-  
+  _allocate(_len);
 }
 
 AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer(const AsyncWebSocketMessageBuffer & copy)
-  :_data(nullptr)
+  :_frame(nullptr)
+  ,_data(nullptr)
   ,_len(0)
   ,_lock(false)
   ,_count(0)
+  ,_headerOpcode(WS_CONTINUATION)
+  ,_headerLen(0)
 {
   _len = copy._len;
   _lock = copy._lock;
-  _count = 0;
-
-  if (_len) {
-    _data = new uint8_t[_len + 1]; 
-    _data[_len] = 0; 
-  } 
 
-  if (_data) {
+  if (_len && _allocate(_len)) {
     memcpy(_data, copy._data, _len);
-    _data[_len] = 0; 
   }
 
 }
 
 AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer(AsyncWebSocketMessageBuffer && copy)
-  :_data(nullptr)
+  :_frame(nullptr)
+  ,_data(nullptr)
   ,_len(0)
   ,_lock(false)
   ,_count(0)
+  ,_headerOpcode(copy._headerOpcode.load())
+  ,_headerLen(copy._headerLen)
 {
   _len = copy._len;
   _lock = copy._lock;
-  _count = 0;
 
-  if (copy._data) {
-    _data = copy._data; 
-    copy._data = nullptr; 
+  if (copy._frame) {
+    _frame = copy._frame;
+    _data = copy._data;
+    copy._frame = nullptr;
+    copy._data = nullptr;
   } 
 
 }
 
 AsyncWebSocketMessageBuffer::~AsyncWebSocketMessageBuffer()
 {
-    if (_data) {
-      delete[] _data; 
+    if (_frame) {
+      delete[] _frame; 
     }
 }
 
+bool AsyncWebSocketMessageBuffer::_allocate(size_t size)
+{
+  _frame = new uint8_t[WS_MAX_HEADER_LEN + size + 1];
+  if (!_frame) {
+    _data = nullptr;
+    return false;
+  }
+  _data = _frame + WS_MAX_HEADER_LEN;
+  _data[size] = 0;
+  return true;
+}
+
 bool AsyncWebSocketMessageBuffer::reserve(size_t size) 
 {
   _len = size; 
+  _headerOpcode = WS_CONTINUATION;
 
-  if (_data) {
-    delete[] _data;
+  if (_frame) {
+    delete[] _frame;
+    _frame = nullptr;
     _data = nullptr; 
   }
 
-  _data = new uint8_t[_len + 1];
+  return _allocate(_len);
+}
 
-  if (_data) {
-    _data[_len] = 0;
-    return true; 
-  } else {
-    return false; 
+//marks a header that is being written, frame() gives nothing until it is done
+#define WS_HEADER_SEALING 0xFF
+
+void AsyncWebSocketMessageBuffer::seal(uint8_t opcode)
+{
+  if (!_data || _len > 0xFFFF) {
+    return;
+  }
+  //the buffer can be queued from several tasks, only the first one writes the header
+  uint8_t open = WS_CONTINUATION;
+  if (!_headerOpcode.compare_exchange_strong(open, WS_HEADER_SEALING)) {
+    return;
   }
+  uint8_t header[WS_MAX_HEADER_LEN];
+  _headerLen = webSocketFrameHeader(header, true, opcode, false, _len, NULL);
+  memcpy(_data - _headerLen, header, _headerLen);
+  _headerOpcode.store(opcode, std::memory_order_release);
+}
 
+const uint8_t * AsyncWebSocketMessageBuffer::frame(uint8_t opcode, size_t &len) const
+{
+  if (_headerOpcode.load(std::memory_order_acquire) != opcode) {
+    return nullptr;
+  }
+  len = _headerLen + _len;
+  return _data - _headerLen;
 }
 
 
@@ -388,6 +420,7 @@ AsyncWebSocketMultiMessage::AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuff
   if (buffer) {
     _WSbuffer = buffer; 
     (*_WSbuffer)++; 
+    _WSbuffer->seal(_opcode);
     _data = buffer->get(); 
     _len = buffer->length(); 
     _status = WS_MSG_SENDING;
@@ -429,6 +462,23 @@ AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
       return 0;
   }
 
+  //the whole message fits, send the shared frame with the header built in. It is not copied, this
+  //message keeps the buffer alive until the frame is acked and the connection aborts instead of
+  //closing gracefully if it goes away earlier
+  if(_sent == 0 && !_mask && _len <= webSocketSendFrameWindow(client)){
+    size_t frameLen;
+    const uint8_t * frame = _WSbuffer->frame(_opcode, frameLen);
+    if(frame != NULL){
+      AsyncTxSegment segment = {(const char *)frame, frameLen, 0};
+      if(client->writev(&segment, 1) != frameLen){
+        return 0;
+      }
+      _sent = _len;
+      _ack = frameLen;
+      return _len;
+    }
+  }
+
   size_t toSend = _len - _sent;
   size_t window = webSocketSendFrameWindow(client);
 
@@ -463,9 +513,16 @@ AsyncWebSocketMultiMessage::~AsyncWebSocketMultiMessage() {
  const char * AWSC_PING_PAYLOAD = "ESPAsyncWebServer-PING";
  const size_t AWSC_PING_PAYLOAD_LEN = 22;
 
-AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server)
-  : _controlQueue(LinkedList<AsyncWebSocketControl *>([](AsyncWebSocketControl *c){ delete  c; }))
-  , _messageQueue(LinkedList<AsyncWebSocketMessage *>([](AsyncWebSocketMessage *m){ delete  m; }))
+AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server, const char *protocol)
+  : _protocol(protocol)
+  , _controlQueue([](AsyncWebSocketControl * const &c){ delete  c; })
+  , _messageQueue([this](AsyncWebSocketMessage *m){
+      _queuedBytes -= m->length();
+      delete  m;
+    })
+  , _queuedBytes(0)
+  , _droppedMessages(0)
+  , _bytesSent(0)
   , _tempObject(NULL)
 {
   _client = request->client();
@@ -475,12 +532,13 @@ AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebServerRequest *request, Async
   _pstate = 0;
   _lastMessageTime = millis();
   _keepAlivePeriod = 0;
+  setBackpressure(_server->backpressure(), _server->queueLimit());
   _client->setRxTimeout(0);
   _client->onError([](void *r, AsyncClient* c, int8_t error){ (void)c; ((AsyncWebSocketClient*)(r))->_onError(error); }, this);
   _client->onAck([](void *r, AsyncClient* c, size_t len, uint32_t time){ (void)c; ((AsyncWebSocketClient*)(r))->_onAck(len, time); }, this);
   _client->onDisconnect([](void *r, AsyncClient* c){ ((AsyncWebSocketClient*)(r))->_onDisconnect(); delete c; }, this);
   _client->onTimeout([](void *r, AsyncClient* c, uint32_t time){ (void)c; ((AsyncWebSocketClient*)(r))->_onTimeout(time); }, this);
-  _client->onData([](void *r, AsyncClient* c, void *buf, size_t len){ (void)c; ((AsyncWebSocketClient*)(r))->_onData(buf, len); }, this);
+  _client->onSegments([](void *r, AsyncClient* c, AsyncRxSegment *segments, size_t count){ (void)c; for(size_t i = 0; i < count; i++) ((AsyncWebSocketClient*)(r))->_onData(segments[i].data, segments[i].len); }, this);
   _client->onPoll([](void *r, AsyncClient* c){ (void)c; ((AsyncWebSocketClient*)(r))->_onPoll(); }, this);
   _server->_addClient(this);
   _server->_handleEvent(this, WS_EVT_CONNECT, request, NULL, 0);
@@ -495,17 +553,18 @@ AsyncWebSocketClient::~AsyncWebSocketClient(){
 
 void AsyncWebSocketClient::_onAck(size_t len, uint32_t time){
   _lastMessageTime = millis();
+  _bytesSent += len;
   if(!_controlQueue.isEmpty()){
     auto head = _controlQueue.front();
     if(head->finished()){
       len -= head->len();
       if(_status == WS_DISCONNECTING && head->opcode() == WS_DISCONNECT){
-        _controlQueue.remove(head);
+        _controlQueue.pop_front();
         _status = WS_DISCONNECTED;
         _client->close(true);
         return;
       }
-      _controlQueue.remove(head);
+      _controlQueue.pop_front();
     }
   }
   if(len && !_messageQueue.isEmpty()){
@@ -536,7 +595,7 @@ void AsyncWebSocketClient::_runQueue(){
 }
 
 bool AsyncWebSocketClient::queueIsFull(){
-  if((_messageQueue.length() >= WS_MAX_QUEUED_MESSAGES) || (_status != WS_CONNECTED) ) return true;
+  if((_messageQueue.length() >= _queueLimit) || (_status != WS_CONNECTED) ) return true;
   return false;
 }
 
@@ -547,11 +606,40 @@ void AsyncWebSocketClient::_queueMessage(AsyncWebSocketMessage *dataMessage){
     delete dataMessage;
     return;
   }
-  if(_messageQueue.length() >= WS_MAX_QUEUED_MESSAGES){
-      ets_printf("ERROR: Too many messages queued\n");
+  //a message that has started sending has to be finished, or the stream would break mid-frame
+  auto unsent = [](AsyncWebSocketMessage * const &m){ return !m->started(); };
+  if(_backpressure == WS_BACKPRESSURE_COALESCE){
+    uint32_t key = dataMessage->coalesceKey();
+    if(key){
+      _droppedMessages += _messageQueue.remove_if([key](AsyncWebSocketMessage * const &m){ return !m->started() && m->coalesceKey() == key; });
+    }
+    if(_messageQueue.length() >= _queueLimit){
+      //control frames have their own queue, and a message without a key is queued even past the limit
+      if(_messageQueue.remove_first([](AsyncWebSocketMessage * const &m){ return !m->started() && m->coalesceKey(); })){
+        _droppedMessages++;
+      } else if(key){
+        _droppedMessages++;
+        delete dataMessage;
+        dataMessage = NULL;
+      }
+    }
+  } else if(_messageQueue.length() >= _queueLimit){
+    if(_backpressure == WS_BACKPRESSURE_DROP_OLDEST && _messageQueue.remove_first(unsent)){
+      _droppedMessages++;
+    } else {
+      _droppedMessages++;
       delete dataMessage;
-  } else {
-      _messageQueue.add(dataMessage);
+      dataMessage = NULL;
+      if(_backpressure == WS_BACKPRESSURE_DISCONNECT){
+        close(1008, "Too slow");
+        _status = WS_DISCONNECTING; //drop everything else, the connection closes once the close frame is acked
+        return;
+      }
+    }
+  }
+  if(dataMessage != NULL){
+    _messageQueue.add(dataMessage);
+    _queuedBytes += dataMessage->length();
   }
   if(_client->canSend())
     _runQueue();
@@ -560,7 +648,16 @@ void AsyncWebSocketClient::_queueMessage(AsyncWebSocketMessage *dataMessage){
 void AsyncWebSocketClient::_queueControl(AsyncWebSocketControl *controlMessage){
   if(controlMessage == NULL)
     return;
-  _controlQueue.add(controlMessage);
+  if(!_controlQueue.add(controlMessage)){
+    //a close still has to get through, it takes the place of the newest frame not yet sent
+    if(controlMessage->opcode() == WS_DISCONNECT){
+      _controlQueue.pop_back();
+      _controlQueue.add(controlMessage);
+    } else {
+      delete controlMessage;
+      return;
+    }
+  }
   if(_client->canSend())
     _runQueue();
 }
@@ -603,6 +700,8 @@ void AsyncWebSocketClient::_onTimeout(uint32_t time){
 }
 
 void AsyncWebSocketClient::_onDisconnect(){
+  //messages queued from other tasks until the client is deleted are dropped instead of sent to a NULL _client
+  _status = WS_DISCONNECTED;
   _client = NULL;
   _server->_handleDisconnect(this);
 }
@@ -791,9 +890,11 @@ void AsyncWebSocketClient::text(const __FlashStringHelper *data){
     free(message);
   }
 }
-void AsyncWebSocketClient::text(AsyncWebSocketMessageBuffer * buffer)
+void AsyncWebSocketClient::text(AsyncWebSocketMessageBuffer * buffer, uint32_t coalesceKey)
 {
-  _queueMessage(new AsyncWebSocketMultiMessage(buffer));
+  AsyncWebSocketMessage * message = new AsyncWebSocketMultiMessage(buffer);
+  message->setCoalesceKey(coalesceKey);
+  _queueMessage(message);
 }
 
 void AsyncWebSocketClient::binary(const char * message, size_t len){
@@ -822,9 +923,11 @@ void AsyncWebSocketClient::binary(const __FlashStringHelper *data, size_t len){
   }
   
 }
-void AsyncWebSocketClient::binary(AsyncWebSocketMessageBuffer * buffer)
+void AsyncWebSocketClient::binary(AsyncWebSocketMessageBuffer * buffer, uint32_t coalesceKey)
 {
-  _queueMessage(new AsyncWebSocketMultiMessage(buffer, WS_BINARY));
+  AsyncWebSocketMessage * message = new AsyncWebSocketMultiMessage(buffer, WS_BINARY);
+  message->setCoalesceKey(coalesceKey);
+  _queueMessage(message);
 }
 
 IPAddress AsyncWebSocketClient::remoteIP() {
@@ -841,6 +944,12 @@ uint16_t AsyncWebSocketClient::remotePort() {
     return _client->remotePort();
 }
 
+bool AsyncWebSocketClient::hasProtocol(const char * protocol) const {
+  if(_protocol == NULL || protocol == NULL)
+    return _protocol == protocol;
+  return strcmp(_protocol, protocol) == 0;
+}
+
 
 
 /*
@@ -852,6 +961,9 @@ AsyncWebSocket::AsyncWebSocket(const String& url)
   ,_clients(LinkedList<AsyncWebSocketClient *>([](AsyncWebSocketClient *c){ delete c; }))
   ,_cNextId(1)
   ,_enabled(true)
+  ,_backpressure(WS_BACKPRESSURE_DROP_NEWEST)
+  ,_queueLimit(WS_MAX_QUEUED_MESSAGES)
+  ,_protocols(LinkedList<const char *>(nullptr))
   ,_buffers(LinkedList<AsyncWebSocketMessageBuffer *>([](AsyncWebSocketMessageBuffer *b){ delete b; }))
 {
   _eventHandler = NULL;
@@ -958,6 +1070,18 @@ void AsyncWebSocket::textAll(AsyncWebSocketMessageBuffer * buffer){
 }
 
 
+void AsyncWebSocket::textAll(AsyncWebSocketMessageBuffer * buffer, const char * protocol){
+  if (!buffer) return;
+  buffer->lock();
+  for(const auto& c: _clients){
+    if(c->status() == WS_CONNECTED && c->hasProtocol(protocol)){
+        c->text(buffer);
+    }
+  }
+  buffer->unlock();
+  _cleanBuffers();
+}
+
 void AsyncWebSocket::textAll(const char * message, size_t len){
   AsyncWebSocketMessageBuffer * WSBuffer = makeBuffer((uint8_t *)message, len); 
     textAll(WSBuffer); 
@@ -986,6 +1110,18 @@ void AsyncWebSocket::binaryAll(AsyncWebSocketMessageBuffer * buffer)
   _cleanBuffers(); 
 }
 
+void AsyncWebSocket::binaryAll(AsyncWebSocketMessageBuffer * buffer, const char * protocol)
+{
+  if (!buffer) return;
+  buffer->lock();
+  for(const auto& c: _clients){
+    if(c->status() == WS_CONNECTED && c->hasProtocol(protocol))
+      c->binary(buffer);
+  }
+  buffer->unlock();
+  _cleanBuffers();
+}
+
 void AsyncWebSocket::message(uint32_t id, AsyncWebSocketMessage *message){
   AsyncWebSocketClient * c = client(id);
   if(c)
@@ -1186,15 +1322,43 @@ void AsyncWebSocket::handleRequest(AsyncWebServerRequest *request){
     return;
   }
   AsyncWebHeader* key = request->getHeader(WS_STR_KEY);
-  AsyncWebServerResponse *response = new AsyncWebSocketResponse(key->value(), this);
-  if(request->hasHeader(WS_STR_PROTOCOL)){
+  if(request->hasHeader(WS_STR_PROTOCOL) && _protocols.isEmpty()){
+    //no protocols registered, echo whatever the client asked for
     AsyncWebHeader* protocol = request->getHeader(WS_STR_PROTOCOL);
-    //ToDo: check protocol
+    AsyncWebServerResponse *response = new AsyncWebSocketResponse(key->value(), this);
     response->addHeader(WS_STR_PROTOCOL, protocol->value());
+    request->send(response);
+    return;
+  }
+  const char * selected = NULL;
+  if(request->hasHeader(WS_STR_PROTOCOL)){
+    selected = selectProtocol(request->getHeader(WS_STR_PROTOCOL)->value());
+  }
+  AsyncWebServerResponse *response = new AsyncWebSocketResponse(key->value(), this, selected);
+  if(selected != NULL){
+    response->addHeader(WS_STR_PROTOCOL, selected);
   }
   request->send(response);
 }
 
+const char * AsyncWebSocket::selectProtocol(const String& offered) const {
+  //the offer is a comma separated list in order of client preference
+  int start = 0;
+  while(start < (int)offered.length()){
+    int end = offered.indexOf(',', start);
+    if(end < 0)
+      end = offered.length();
+    String name = offered.substring(start, end);
+    name.trim();
+    for(const auto& p: _protocols){
+      if(name.equals(p))
+        return p;
+    }
+    start = end + 1;
+  }
+  return NULL;
+}
+
 AsyncWebSocketMessageBuffer * AsyncWebSocket::makeBuffer(size_t size)
 {
   AsyncWebSocketMessageBuffer * buffer = new AsyncWebSocketMessageBuffer(size); 
@@ -1221,11 +1385,8 @@ void AsyncWebSocket::_cleanBuffers()
 {
   AsyncWebLockGuard l(_lock);
 
-  for(AsyncWebSocketMessageBuffer * c: _buffers){
-    if(c && c->canDelete()){
-        _buffers.remove(c);
-    }
-  }
+  //removing while iterating would step through a deleted node
+  while(_buffers.remove_first([](AsyncWebSocketMessageBuffer * c){ return c && c->canDelete(); }));
 }
 
 AsyncWebSocket::AsyncWebSocketClientLinkedList AsyncWebSocket::getClients() const {
@@ -1237,8 +1398,9 @@ AsyncWebSocket::AsyncWebSocketClientLinkedList AsyncWebSocket::getClients() cons
  * Authentication code from https://github.com/Links2004/arduinoWebSockets/blob/master/src/WebSockets.cpp#L480
  */
 
-AsyncWebSocketResponse::AsyncWebSocketResponse(const String& key, AsyncWebSocket *server){
+AsyncWebSocketResponse::AsyncWebSocketResponse(const String& key, AsyncWebSocket *server, const char *protocol){
   _server = server;
+  _protocol = protocol;
   _code = 101;
   _sendContentLength = false;
 
@@ -1288,7 +1450,7 @@ void AsyncWebSocketResponse::_respond(AsyncWebServerRequest *request){
 size_t AsyncWebSocketResponse::_ack(AsyncWebServerRequest *request, size_t len, uint32_t time){
   (void)time;
   if(len){
-    new AsyncWebSocketClient(request, _server);
+    new AsyncWebSocketClient(request, _server, _protocol);
   }
   return 0;
 }
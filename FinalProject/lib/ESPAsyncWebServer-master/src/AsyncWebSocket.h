@@ -33,6 +33,8 @@
 
 #include "AsyncWebSynchronization.h"
 
+#include <atomic>
+
 #ifdef ESP8266
 #include <Hash.h>
 #ifdef CRYPTO_HASH_h // include Hash.h from espressif framework if the first include was from the crypto library
@@ -46,6 +48,12 @@
 #define DEFAULT_MAX_WS_CLIENTS 4
 #endif
 
+//longest header of an unmasked frame with a 16 bit payload length
+#define WS_MAX_HEADER_LEN 4
+
+//pings, pongs and closes waiting to be sent, a peer pinging faster than it reads loses pongs beyond this
+#define WS_MAX_QUEUED_CONTROLS 8
+
 class AsyncWebSocket;
 class AsyncWebSocketResponse;
 class AsyncWebSocketClient;
@@ -79,13 +87,30 @@ typedef enum { WS_DISCONNECTED, WS_CONNECTED, WS_DISCONNECTING } AwsClientStatus
 typedef enum { WS_CONTINUATION, WS_TEXT, WS_BINARY, WS_DISCONNECT = 0x08, WS_PING, WS_PONG } AwsFrameType;
 typedef enum { WS_MSG_SENDING, WS_MSG_SENT, WS_MSG_ERROR } AwsMessageStatus;
 typedef enum { WS_EVT_CONNECT, WS_EVT_DISCONNECT, WS_EVT_PONG, WS_EVT_ERROR, WS_EVT_DATA } AwsEventType;
-
+//what to do with a message for a client whose queue is full
+typedef enum {
+  WS_BACKPRESSURE_DROP_NEWEST,     //drop the new message
+  WS_BACKPRESSURE_DROP_OLDEST,     //drop the oldest message that has not started sending
+  WS_BACKPRESSURE_COALESCE,        //a new message replaces the queued ones with its coalesce key that have not started sending.
+                                   //A full queue drops its oldest keyed message, messages without a key are never dropped
+  WS_BACKPRESSURE_DISCONNECT       //drop the new message and close the connection
+} AwsBackpressurePolicy;
+
+//Payload shared by every client it is sent to. Room for a frame header is kept in front of the
+//payload. The header is encoded once, when the buffer is first queued, and from then on the
+//buffer is read only: a message that fits the TCP window goes out with a single add() of the
+//shared frame, which is referenced rather than copied until the client acks it.
 class AsyncWebSocketMessageBuffer {
   private:
+    uint8_t * _frame;
     uint8_t * _data;
     size_t _len;
     bool _lock; 
-    uint32_t _count;  
+    std::atomic<uint32_t> _count;
+    std::atomic<uint8_t> _headerOpcode; //opcode the header in front of _data was built for, WS_CONTINUATION if none
+    uint8_t _headerLen;
+
+    bool _allocate(size_t size);
 
   public:
     AsyncWebSocketMessageBuffer();
@@ -103,23 +128,33 @@ class AsyncWebSocketMessageBuffer {
     size_t length() { return _len; }
     uint32_t count() { return _count; }
     bool canDelete() { return (!_count && !_lock); } 
+    //encodes the frame header for opcode, only the first call has an effect. Called when the buffer is queued
+    void seal(uint8_t opcode);
+    //whole unmasked final frame of the payload, NULL if it was sealed for another opcode or is too long for a single frame
+    const uint8_t * frame(uint8_t opcode, size_t &len) const;
 
     friend AsyncWebSocket; 
 
 };
 
-class AsyncWebSocketMessage {
+class AsyncWebSocketMessage: public IntrusiveListNode<AsyncWebSocketMessage> {
   protected:
     uint8_t _opcode;
     bool _mask;
     AwsMessageStatus _status;
+    uint32_t _coalesceKey;
   public:
-    AsyncWebSocketMessage():_opcode(WS_TEXT),_mask(false),_status(WS_MSG_ERROR){}
+    AsyncWebSocketMessage():_opcode(WS_TEXT),_mask(false),_status(WS_MSG_ERROR),_coalesceKey(0){}
     virtual ~AsyncWebSocketMessage(){}
     virtual void ack(size_t len __attribute__((unused)), uint32_t time __attribute__((unused))){}
     virtual size_t send(AsyncClient *client __attribute__((unused))){ return 0; }
     virtual bool finished(){ return _status != WS_MSG_SENDING; }
     virtual bool betweenFrames() const { return false; }
+    virtual bool started() const { return false; }
+    virtual size_t length() const { return 0; }
+    //messages with the same non-zero key supersede each other under WS_BACKPRESSURE_COALESCE, 0 never does
+    void setCoalesceKey(uint32_t key){ _coalesceKey = key; }
+    uint32_t coalesceKey() const { return _coalesceKey; }
 };
 
 class AsyncWebSocketBasicMessage: public AsyncWebSocketMessage {
@@ -134,6 +169,8 @@ public:
     AsyncWebSocketBasicMessage(uint8_t opcode=WS_TEXT, bool mask=false);
     virtual ~AsyncWebSocketBasicMessage() override;
     virtual bool betweenFrames() const override { return _acked == _ack; }
+    virtual bool started() const override { return _sent > 0; }
+    virtual size_t length() const override { return _len; }
     virtual void ack(size_t len, uint32_t time) override ;
     virtual size_t send(AsyncClient *client) override ;
 };
@@ -150,6 +187,8 @@ public:
     AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuffer * buffer, uint8_t opcode=WS_TEXT, bool mask=false); 
     virtual ~AsyncWebSocketMultiMessage() override;
     virtual bool betweenFrames() const override { return _acked == _ack; }
+    virtual bool started() const override { return _sent > 0; }
+    virtual size_t length() const override { return _len; }
     virtual void ack(size_t len, uint32_t time) override ;
     virtual size_t send(AsyncClient *client) override ;
 };
@@ -160,9 +199,10 @@ class AsyncWebSocketClient {
     AsyncWebSocket *_server;
     uint32_t _clientId;
     AwsClientStatus _status;
+    const char *_protocol;
 
-    LinkedList<AsyncWebSocketControl *> _controlQueue;
-    LinkedList<AsyncWebSocketMessage *> _messageQueue;
+    RingQueue<AsyncWebSocketControl *, WS_MAX_QUEUED_CONTROLS> _controlQueue;
+    IntrusiveList<AsyncWebSocketMessage> _messageQueue;
 
     uint8_t _pstate;
     AwsFrameInfo _pinfo;
@@ -170,6 +210,12 @@ class AsyncWebSocketClient {
     uint32_t _lastMessageTime;
     uint32_t _keepAlivePeriod;
 
+    AwsBackpressurePolicy _backpressure;
+    size_t _queueLimit;
+    size_t _queuedBytes;
+    uint32_t _droppedMessages;
+    uint64_t _bytesSent;
+
     void _queueMessage(AsyncWebSocketMessage *dataMessage);
     void _queueControl(AsyncWebSocketControl *controlMessage);
     void _runQueue();
@@ -177,7 +223,7 @@ class AsyncWebSocketClient {
   public:
     void *_tempObject;
 
-    AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server);
+    AsyncWebSocketClient(AsyncWebServerRequest *request, AsyncWebSocket *server, const char *protocol = NULL);
     ~AsyncWebSocketClient();
 
     //client id increments for the given server
@@ -186,6 +232,9 @@ class AsyncWebSocketClient {
     AsyncClient* client(){ return _client; }
     AsyncWebSocket *server(){ return _server; }
     AwsFrameInfo const &pinfo() const { return _pinfo; }
+    //subprotocol agreed on in the handshake, NULL if none
+    const char * protocol() const { return _protocol; }
+    bool hasProtocol(const char * protocol) const;
 
     IPAddress remoteIP();
     uint16_t  remotePort();
@@ -206,6 +255,20 @@ class AsyncWebSocketClient {
     void message(AsyncWebSocketMessage *message){ _queueMessage(message); }
     bool queueIsFull();
 
+    //how messages are handled once queueLimit messages wait for this client
+    void setBackpressure(AwsBackpressurePolicy policy, size_t queueLimit = WS_MAX_QUEUED_MESSAGES){
+      _backpressure = policy;
+      _queueLimit = queueLimit ? queueLimit : 1;
+    }
+    AwsBackpressurePolicy backpressure() const { return _backpressure; }
+    //messages waiting or being sent, and their payload bytes
+    size_t queueLength() const { return _messageQueue.length(); }
+    size_t queuedBytes() const { return _queuedBytes; }
+    //messages dropped by the backpressure policy
+    uint32_t droppedMessages() const { return _droppedMessages; }
+    //bytes acknowledged by the peer, frame headers included
+    uint64_t bytesSent() const { return _bytesSent; }
+
     size_t printf(const char *format, ...)  __attribute__ ((format (printf, 2, 3)));
 #ifndef ESP32
     size_t printf_P(PGM_P formatP, ...)  __attribute__ ((format (printf, 2, 3)));
@@ -216,7 +279,7 @@ class AsyncWebSocketClient {
     void text(char * message);
     void text(const String &message);
     void text(const __FlashStringHelper *data);
-    void text(AsyncWebSocketMessageBuffer *buffer); 
+    void text(AsyncWebSocketMessageBuffer *buffer, uint32_t coalesceKey = 0);
 
     void binary(const char * message, size_t len);
     void binary(const char * message);
@@ -224,9 +287,9 @@ class AsyncWebSocketClient {
     void binary(char * message);
     void binary(const String &message);
     void binary(const __FlashStringHelper *data, size_t len);
-    void binary(AsyncWebSocketMessageBuffer *buffer); 
+    void binary(AsyncWebSocketMessageBuffer *buffer, uint32_t coalesceKey = 0);
 
-    bool canSend() { return _messageQueue.length() < WS_MAX_QUEUED_MESSAGES; }
+    bool canSend() { return _messageQueue.length() < _queueLimit; }
 
     //system callbacks (do not call)
     void _onAck(size_t len, uint32_t time);
@@ -249,7 +312,10 @@ class AsyncWebSocket: public AsyncWebHandler {
     uint32_t _cNextId;
     AwsEventHandler _eventHandler;
     bool _enabled;
+    AwsBackpressurePolicy _backpressure;
+    size_t _queueLimit;
     AsyncWebLock _lock;
+    LinkedList<const char *> _protocols;
 
   public:
     AsyncWebSocket(const String& url);
@@ -257,6 +323,20 @@ class AsyncWebSocket: public AsyncWebHandler {
     const char * url() const { return _url.c_str(); }
     void enable(bool e){ _enabled = e; }
     bool enabled() const { return _enabled; }
+
+    //backpressure policy given to clients as they connect
+    void setBackpressure(AwsBackpressurePolicy policy, size_t queueLimit = WS_MAX_QUEUED_MESSAGES){
+      _backpressure = policy;
+      _queueLimit = queueLimit;
+    }
+    AwsBackpressurePolicy backpressure() const { return _backpressure; }
+    size_t queueLimit() const { return _queueLimit; }
+
+    //subprotocols the server speaks. Once any is added, the first protocol a client offers that is
+    //in this list is selected during the handshake, and an offer without a match gets no protocol.
+    //The string must stay valid for the lifetime of the server.
+    void addProtocol(const char * protocol){ _protocols.add(protocol); }
+    const char * selectProtocol(const String& offered) const;
     bool availableForWriteAll();
     bool availableForWrite(uint32_t id);
 
@@ -285,6 +365,8 @@ class AsyncWebSocket: public AsyncWebHandler {
     void textAll(const String &message);
     void textAll(const __FlashStringHelper *message); //  need to convert
     void textAll(AsyncWebSocketMessageBuffer * buffer); 
+    //only to clients that agreed on protocol, or to clients without a subprotocol if it is NULL
+    void textAll(AsyncWebSocketMessageBuffer * buffer, const char * protocol);
 
     void binary(uint32_t id, const char * message, size_t len);
     void binary(uint32_t id, const char * message);
@@ -300,6 +382,7 @@ class AsyncWebSocket: public AsyncWebHandler {
     void binaryAll(const String &message);
     void binaryAll(const __FlashStringHelper *message, size_t len);
     void binaryAll(AsyncWebSocketMessageBuffer * buffer); 
+    void binaryAll(AsyncWebSocketMessageBuffer * buffer, const char * protocol);
 
     void message(uint32_t id, AsyncWebSocketMessage *message);
     void messageAll(AsyncWebSocketMultiMessage *message);
@@ -339,8 +422,9 @@ class AsyncWebSocketResponse: public AsyncWebServerResponse {
   private:
     String _content;
     AsyncWebSocket *_server;
+    const char *_protocol;
   public:
-    AsyncWebSocketResponse(const String& key, AsyncWebSocket *server);
+    AsyncWebSocketResponse(const String& key, AsyncWebSocket *server, const char *protocol = NULL);
     void _respond(AsyncWebServerRequest *request);
     size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time);
     bool _sourceValid() const { return true; }
@@ -80,7 +80,7 @@ typedef std::function<void(void)> ArDisconnectHandler;
  * PARAMETER :: Chainable object to hold GET/POST and FILE parameters
  * */
 
-class AsyncWebParameter {
+class AsyncWebParameter: public IntrusiveListNode<AsyncWebParameter> {
   private:
     String _name;
     String _value;
@@ -102,7 +102,7 @@ class AsyncWebParameter {
  * HEADER :: Chainable object to hold the headers
  * */
 
-class AsyncWebHeader {
+class AsyncWebHeader: public IntrusiveListNode<AsyncWebHeader> {
   private:
     String _name;
     String _value;
@@ -163,8 +163,8 @@ class AsyncWebServerRequest {
     size_t _contentLength;
     size_t _parsedLength;
 
-    LinkedList<AsyncWebHeader *> _headers;
-    LinkedList<AsyncWebParameter *> _params;
+    IntrusiveList<AsyncWebHeader> _headers;
+    IntrusiveList<AsyncWebParameter> _params;
     LinkedList<String *> _pathParams;
 
     uint8_t _multiParseState;
@@ -358,7 +358,7 @@ typedef enum {
 class AsyncWebServerResponse {
   protected:
     int _code;
-    LinkedList<AsyncWebHeader *> _headers;
+    IntrusiveList<AsyncWebHeader> _headers;
     String _contentType;
     size_t _contentLength;
     bool _sendContentLength;
@@ -439,11 +439,11 @@ class AsyncWebServer {
 };
 
 class DefaultHeaders {
-  using headers_t = LinkedList<AsyncWebHeader *>;
+  using headers_t = IntrusiveList<AsyncWebHeader>;
   headers_t _headers;
   
   DefaultHeaders()
-  :_headers(headers_t([](AsyncWebHeader *h){ delete h; }))
+  :_headers([](AsyncWebHeader *h){ delete h; })
   {}
 public:
   using ConstIterator = headers_t::ConstIterator;
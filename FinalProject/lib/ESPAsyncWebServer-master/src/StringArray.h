@@ -23,6 +23,7 @@
 
 #include "stddef.h"
 #include "WString.h"
+#include <functional>
 
 template <typename T>
 class LinkedListNode {
@@ -171,6 +172,201 @@ class LinkedList {
     }
 };
 
+//Base of objects kept in an IntrusiveList. The link lives in the object itself,
+//so adding it to a list allocates nothing. An object can be in one list at a time.
+template <typename T>
+class IntrusiveListNode {
+    template<typename> friend class IntrusiveList;
+    T* _listNext;
+  public:
+    IntrusiveListNode(): _listNext(nullptr) {}
+};
+
+//Singly linked list of heap objects that derive from IntrusiveListNode<T>.
+//add(), front(), isEmpty() and length() are O(1). Removed objects are handed to OnRemove.
+template <typename T>
+class IntrusiveList {
+  public:
+    typedef std::function<void(T* const&)> OnRemove;
+    typedef std::function<bool(T* const&)> Predicate;
+  private:
+    T* _root;
+    T* _last;
+    size_t _length;
+    OnRemove _onRemove;
+
+    class Iterator {
+      T* _node;
+    public:
+      Iterator(T* current = nullptr) : _node(current) {}
+      Iterator(const Iterator& i) : _node(i._node) {}
+      Iterator& operator ++() { _node = _node->_listNext; return *this; }
+      bool operator != (const Iterator& i) const { return _node != i._node; }
+      T* operator * () const { return _node; }
+    };
+
+    void _unlink(T* it, T* previous){
+      if(it == _root){
+        _root = it->_listNext;
+      } else {
+        previous->_listNext = it->_listNext;
+      }
+      if(it == _last){
+        _last = previous;
+      }
+      it->_listNext = nullptr;
+      _length--;
+      if (_onRemove) {
+        _onRemove(it);
+      }
+    }
+
+  public:
+    typedef const Iterator ConstIterator;
+    ConstIterator begin() const { return ConstIterator(_root); }
+    ConstIterator end() const { return ConstIterator(nullptr); }
+
+    IntrusiveList(OnRemove onRemove = nullptr) : _root(nullptr), _last(nullptr), _length(0), _onRemove(onRemove) {}
+    IntrusiveList(const IntrusiveList &) = delete;
+    IntrusiveList &operator=(const IntrusiveList &) = delete;
+    ~IntrusiveList(){}
+
+    void add(T* t){
+      t->_listNext = nullptr;
+      if(!_root){
+        _root = t;
+      } else {
+        _last->_listNext = t;
+      }
+      _last = t;
+      _length++;
+    }
+    T* front() const {
+      return _root;
+    }
+    bool isEmpty() const {
+      return _root == nullptr;
+    }
+    size_t length() const {
+      return _length;
+    }
+    size_t count_if(Predicate predicate) const {
+      if (!predicate){
+        return _length;
+      }
+      size_t i = 0;
+      for(T* it = _root; it; it = it->_listNext){
+        if (predicate(it)) {
+          i++;
+        }
+      }
+      return i;
+    }
+    T* nth(size_t N) const {
+      T* it = _root;
+      while(it && N--){
+        it = it->_listNext;
+      }
+      return it;
+    }
+    bool remove(T* t){
+      return remove_first([t](T* const &it){ return it == t; });
+    }
+    bool remove_first(Predicate predicate){
+      T* previous = nullptr;
+      for(T* it = _root; it; previous = it, it = it->_listNext){
+        if(predicate(it)){
+          _unlink(it, previous);
+          return true;
+        }
+      }
+      return false;
+    }
+    //removes every match in a single pass, returns how many were removed
+    size_t remove_if(Predicate predicate){
+      size_t removed = 0;
+      T* previous = nullptr;
+      T* it = _root;
+      while(it){
+        T* next = it->_listNext;
+        if(predicate(it)){
+          _unlink(it, previous);
+          removed++;
+        } else {
+          previous = it;
+        }
+        it = next;
+      }
+      return removed;
+    }
+
+    void free(){
+      while(_root != nullptr){
+        _unlink(_root, nullptr);
+      }
+    }
+};
+
+//FIFO of up to N values in a fixed array, nothing is allocated after construction.
+//Removed values are handed to OnRemove.
+template <typename T, size_t N>
+class RingQueue {
+  public:
+    typedef std::function<void(const T&)> OnRemove;
+  private:
+    T _items[N];
+    size_t _head;
+    size_t _length;
+    OnRemove _onRemove;
+
+    T& _at(size_t i) { return _items[(_head + i) % N]; }
+
+  public:
+    RingQueue(OnRemove onRemove = nullptr) : _head(0), _length(0), _onRemove(onRemove) {}
+    RingQueue(const RingQueue &) = delete;
+    RingQueue &operator=(const RingQueue &) = delete;
+
+    //returns false and keeps the queue unchanged if it is full
+    bool add(const T& t){
+      if(_length == N){
+        return false;
+      }
+      _items[(_head + _length) % N] = t;
+      _length++;
+      return true;
+    }
+    T& front() { return _items[_head]; }
+    T& back() { return _at(_length - 1); }
+    bool isEmpty() const { return _length == 0; }
+    bool isFull() const { return _length == N; }
+    size_t length() const { return _length; }
+    static constexpr size_t capacity() { return N; }
+
+    void pop_front(){
+      if(!_length) return;
+      T t = _items[_head];
+      _head = (_head + 1) % N;
+      _length--;
+      if (_onRemove) {
+        _onRemove(t);
+      }
+    }
+    void pop_back(){
+      if(!_length) return;
+      T t = back();
+      _length--;
+      if (_onRemove) {
+        _onRemove(t);
+      }
+    }
+    void free(){
+      while(_length){
+        pop_front();
+      }
+      _head = 0;
+    }
+};
+
 
 class StringArray : public LinkedList<String> {
 public:
@@ -30,6 +30,21 @@ static const String SharedEmptyString = String();
 
 #define __is_param_char(c) ((c) && ((c) != '{') && ((c) != '[') && ((c) != '&') && ((c) != '='))
 
+//String::concat(str, len) of arduino-esp32 2.x copies str[len] too, which is past the end of a
+//network buffer. The data goes through a terminated copy in small pieces instead
+static void appendBounded(String &text, const char *str, size_t len){
+  char chunk[64];
+  text.reserve(text.length() + len);
+  while(len){
+    size_t n = (len < sizeof(chunk) - 1) ? len : sizeof(chunk) - 1;
+    memcpy(chunk, str, n);
+    chunk[n] = 0;
+    text.concat(chunk, n);
+    str += n;
+    len -= n;
+  }
+}
+
 enum { PARSE_REQ_START, PARSE_REQ_HEADERS, PARSE_REQ_BODY, PARSE_REQ_END, PARSE_REQ_FAIL };
 
 AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
@@ -53,8 +68,8 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   , _expectingContinue(false)
   , _contentLength(0)
   , _parsedLength(0)
-  , _headers(LinkedList<AsyncWebHeader *>([](AsyncWebHeader *h){ delete h; }))
-  , _params(LinkedList<AsyncWebParameter *>([](AsyncWebParameter *p){ delete p; }))
+  , _headers([](AsyncWebHeader *h){ delete h; })
+  , _params([](AsyncWebParameter *p){ delete p; })
   , _pathParams(LinkedList<String *>([](String *p){ delete p; }))
   , _multiParseState(0)
   , _boundaryPosition(0)
@@ -73,7 +88,7 @@ AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* s, AsyncClient* c)
   c->onAck([](void *r, AsyncClient* c, size_t len, uint32_t time){ (void)c; AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; req->_onAck(len, time); }, this);
   c->onDisconnect([](void *r, AsyncClient* c){ AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; req->_onDisconnect(); delete c; }, this);
   c->onTimeout([](void *r, AsyncClient* c, uint32_t time){ (void)c; AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; req->_onTimeout(time); }, this);
-  c->onData([](void *r, AsyncClient* c, void *buf, size_t len){ (void)c; AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; req->_onData(buf, len); }, this);
+  c->onSegments([](void *r, AsyncClient* c, AsyncRxSegment *segments, size_t count){ (void)c; AsyncWebServerRequest *req = (AsyncWebServerRequest*)r; for(size_t i = 0; i < count; i++) req->_onData(segments[i].data, segments[i].len); }, this);
   c->onPoll([](void *r, AsyncClient* c){ (void)c; AsyncWebServerRequest *req = ( AsyncWebServerRequest*)r; req->_onPoll(); }, this);
 }
 
@@ -103,27 +118,19 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len){
   while (true) {
 
   if(_parseState < PARSE_REQ_BODY){
-    // Find new line in buf
-    char *str = (char*)buf;
-    for (i = 0; i < len; i++) {
-      if (str[i] == '\n') {
-        break;
-      }
-    }
+    // Find new line in buf, the line is copied straight out of the network buffer
+    const char *str = (const char*)buf;
+    const char *nl = (const char*)memchr(str, '\n', len);
+    i = nl ? (size_t)(nl - str) : len;
     if (i == len) { // No new line, just add the buffer in _temp
-      char ch = str[len-1];
-      str[len-1] = 0;
-      _temp.reserve(_temp.length()+len);
-      _temp.concat(str);
-      _temp.concat(ch);
+      appendBounded(_temp, str, len);
     } else { // Found new line - extract it and parse
-      str[i] = 0; // Terminate the string at the end of the line.
-      _temp.concat(str);
+      appendBounded(_temp, str, i);
       _temp.trim();
       _parseLine();
       if (++i < len) {
         // Still have more buffer to process
-        buf = str+i;
+        buf = (void*)(str+i);
         len-= i;
         continue;
       }
@@ -180,11 +187,9 @@ void AsyncWebServerRequest::_onData(void *buf, size_t len){
 
 void AsyncWebServerRequest::_removeNotInterestingHeaders(){
   if (_interestingHeaders.containsIgnoreCase("ANY")) return; // nothing to do
-  for(const auto& header: _headers){
-      if(!_interestingHeaders.containsIgnoreCase(header->name().c_str())){
-        _headers.remove(header);
-      }
-  }
+  _headers.remove_if([this](AsyncWebHeader * const &header){
+    return !_interestingHeaders.containsIgnoreCase(header->name().c_str());
+  });
 }
 
 void AsyncWebServerRequest::_onPoll(){
@@ -642,8 +647,7 @@ AsyncWebHeader* AsyncWebServerRequest::getHeader(const __FlashStringHelper * dat
 }
 
 AsyncWebHeader* AsyncWebServerRequest::getHeader(size_t num) const {
-  auto header = _headers.nth(num);
-  return header ? *header : nullptr;
+  return _headers.nth(num);
 }
 
 size_t AsyncWebServerRequest::params() const {
@@ -699,8 +703,7 @@ AsyncWebParameter* AsyncWebServerRequest::getParam(const __FlashStringHelper * d
 }
 
 AsyncWebParameter* AsyncWebServerRequest::getParam(size_t num) const {
-  auto param = _params.nth(num);
-  return param ? *param : nullptr;
+  return _params.nth(num);
 }
 
 void AsyncWebServerRequest::addInterestingHeader(const String& name){
@@ -84,7 +84,7 @@ const char* AsyncWebServerResponse::_responseCodeToString(int code) {
 
 AsyncWebServerResponse::AsyncWebServerResponse()
   : _code(0)
-  , _headers(LinkedList<AsyncWebHeader *>([](AsyncWebHeader *h){ delete h; }))
+  , _headers([](AsyncWebHeader *h){ delete h; })
   , _contentType()
   , _contentLength(0)
   , _sendContentLength(true)
@@ -287,7 +287,8 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, u
   if(_state == RESPONSE_CONTENT){
     size_t outLen;
     if(_chunked){
-      if(space <= 8){
+      // The chunk framing takes 8 bytes, wait for room for content unless the head is still to go
+      if(!headLen && space <= 8){
         return 0;
       }
       outLen = space;
@@ -297,48 +298,62 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, u
       outLen = ((_contentLength - _sentLength) > space)?space:(_contentLength - _sentLength);
     }
 
-    uint8_t *buf = (uint8_t *)malloc(outLen+headLen);
-    if (!buf) {
-      // os_printf("_ack malloc %d failed\n", outLen+headLen);
-      return 0;
-    }
-
-    if(headLen){
-      memcpy(buf, _head.c_str(), _head.length());
+    // The head and the chunk framing go out as their own segments, the buffer only holds the content.
+    // Without room for content, or with none left, only the head goes out.
+    size_t bufLen = outLen;
+    if(_chunked){
+      bufLen = (outLen > 8) ? outLen - 8 : 0;
     }
-
+    bool chunk = _chunked && bufLen;
+    uint8_t *buf = NULL;
     size_t readLen = 0;
-
-    if(_chunked){
-      // HTTP 1.1 allows leading zeros in chunk length. Or spaces may be added.
-      // See RFC2616 sections 2, 3.6.1.
-      readLen = _fillBufferAndProcessTemplates(buf+headLen+6, outLen - 8);
-      if(readLen == RESPONSE_TRY_AGAIN){
-          free(buf);
-          return 0;
+    if(bufLen){
+      buf = (uint8_t *)malloc(bufLen);
+      if (!buf) {
+        // os_printf("_ack malloc %d failed\n", bufLen);
+        return 0;
       }
-      outLen = sprintf((char*)buf+headLen, "%x", readLen) + headLen;
-      while(outLen < headLen + 4) buf[outLen++] = ' ';
-      buf[outLen++] = '\r';
-      buf[outLen++] = '\n';
-      outLen += readLen;
-      buf[outLen++] = '\r';
-      buf[outLen++] = '\n';
-    } else {
-      readLen = _fillBufferAndProcessTemplates(buf+headLen, outLen);
+
+      readLen = _fillBufferAndProcessTemplates(buf, bufLen);
       if(readLen == RESPONSE_TRY_AGAIN){
           free(buf);
           return 0;
       }
-      outLen = readLen + headLen;
     }
 
+    AsyncTxSegment segments[4];
+    size_t count = 0;
+    char chunkHead[8];
     if(headLen){
-        _head = String();
+      segments[count++] = {_head.c_str(), headLen, ASYNC_WRITE_FLAG_COPY};
+    }
+    if(chunk){
+      // HTTP 1.1 allows leading zeros in chunk length. Or spaces may be added.
+      // See RFC2616 sections 2, 3.6.1.
+      size_t chunkHeadLen = sprintf(chunkHead, "%x", readLen);
+      while(chunkHeadLen < 4) chunkHead[chunkHeadLen++] = ' ';
+      chunkHead[chunkHeadLen++] = '\r';
+      chunkHead[chunkHeadLen++] = '\n';
+      segments[count++] = {chunkHead, chunkHeadLen, ASYNC_WRITE_FLAG_COPY};
+    }
+    if(readLen){
+      segments[count++] = {(const char*)buf, readLen, ASYNC_WRITE_FLAG_COPY};
+    }
+    if(chunk){
+      // a literal outlives the send, no copy needed
+      segments[count++] = {"\r\n", 2, 0};
+    }
+    outLen = 0;
+    for(size_t i = 0; i < count; i++){
+      outLen += segments[i].len;
     }
 
     if(outLen){
-        _writtenLength += request->client()->write((const char*)buf, outLen);
+        _writtenLength += request->client()->writev(segments, count);
+    }
+
+    if(headLen){
+        _head = String();
     }
 
     if(_chunked){
@@ -349,7 +364,7 @@ size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, u
 
     free(buf);
 
-    if((_chunked && readLen == 0) || (!_sendContentLength && outLen == 0) || (!_chunked && _sentLength == _contentLength)){
+    if((chunk && readLen == 0) || (!_chunked && !_sendContentLength && outLen == 0) || (!_chunked && _sentLength == _contentLength)){
       _state = RESPONSE_WAIT_ACK;
     }
     return outLen;
@@ -396,7 +411,7 @@ size_t AsyncAbstractResponse::_fillBufferAndProcessTemplates(uint8_t* data, size
     // If closing placeholder is found:
     if(pTemplateEnd) {
       // prepare argument to callback
-      const size_t paramNameLength = std::min(sizeof(buf) - 1, (unsigned int)(pTemplateEnd - pTemplateStart - 1));
+      const size_t paramNameLength = std::min(sizeof(buf) - 1, (size_t)(pTemplateEnd - pTemplateStart - 1));
       if(paramNameLength) {
         memcpy(buf, pTemplateStart + 1, paramNameLength);
         buf[paramNameLength] = 0;
@@ -21,31 +21,60 @@
 
 #include "NTPClient.h"
 
+#ifdef NTP_ASYNC_DNS
+#include "lwip/dns.h"
+#endif
+
+static const char* const NTP_DEFAULT_SERVER = "pool.ntp.org";
+
 NTPClient::NTPClient(UDP& udp) {
   this->_udp            = &udp;
+  this->setServers(&NTP_DEFAULT_SERVER, 1);
 }
 
 NTPClient::NTPClient(UDP& udp, int timeOffset) {
   this->_udp            = &udp;
   this->_timeOffset     = timeOffset;
+  this->setServers(&NTP_DEFAULT_SERVER, 1);
 }
 
 NTPClient::NTPClient(UDP& udp, const char* poolServerName) {
   this->_udp            = &udp;
-  this->_poolServerName = poolServerName;
+  this->setServers(&poolServerName, 1);
 }
 
 NTPClient::NTPClient(UDP& udp, const char* poolServerName, int timeOffset) {
   this->_udp            = &udp;
   this->_timeOffset     = timeOffset;
-  this->_poolServerName = poolServerName;
+  this->setServers(&poolServerName, 1);
 }
 
 NTPClient::NTPClient(UDP& udp, const char* poolServerName, int timeOffset, unsigned long updateInterval) {
   this->_udp            = &udp;
   this->_timeOffset     = timeOffset;
-  this->_poolServerName = poolServerName;
   this->_updateInterval = updateInterval;
+  this->setServers(&poolServerName, 1);
+}
+
+NTPClient::NTPClient(UDP& udp, const char* const* serverNames, uint8_t serverCount, int timeOffset, unsigned long updateInterval) {
+  this->_udp            = &udp;
+  this->_timeOffset     = timeOffset;
+  this->_updateInterval = updateInterval;
+  this->setServers(serverNames, serverCount);
+}
+
+void NTPClient::setServers(const char* const* serverNames, uint8_t serverCount) {
+  this->_serverCount = 0;
+  for (uint8_t i = 0; i < serverCount && this->_serverCount < NTP_MAX_SERVERS; i++) {
+    if (serverNames[i] == NULL) continue;
+    Server& server = this->_servers[this->_serverCount++];
+    server.name        = serverNames[i];
+    server.resolve     = RESOLVE_NONE;
+    server.pending     = false;
+    server.requestSent = 0;
+    server.failures    = 0;
+    server.retryAt     = 0;
+  }
 }
 
 void NTPClient::begin() {
@@ -85,58 +114,266 @@ bool NTPClient::isValid(byte * ntpPacket)
 }
 
 bool NTPClient::forceUpdate() {
+  if (!this->beginUpdate()) return false;
+
+  NTPUpdateStatus status;
+  while ((status = this->poll()) == NTP_UPDATE_PENDING) {
+    delay ( 10 );
+  }
+  return status == NTP_UPDATE_SUCCESS;
+}
+
+bool NTPClient::beginUpdate() {
   #ifdef DEBUG_NTPClient
     Serial.println("Update from NTP Server");
   #endif
+  if (!this->_udpSetup) this->begin();                           // setup the UDP client if needed
+
   // flush any existing packets
   while(this->_udp->parsePacket() != 0)
     this->_udp->flush();
-  this->sendNTPPacket();
 
-  // Wait till data is there or timeout...
-  byte timeout = 0;
-  int cb = 0;
-  do {
-    delay ( 10 );
-    cb = this->_udp->parsePacket();
-    
-    if(cb > 0)
-    {
-      this->_udp->read(this->_packetBuffer, NTP_PACKET_SIZE);
-      if(!this->isValid(this->_packetBuffer))
-        cb = 0;
+  unsigned long now = millis();
+  this->_requestSent = now;
+  this->_bestServer  = -1;
+
+  // Ask every server not backing off, or the one due first if they all are
+  int8_t due = -1;
+  for (uint8_t i = 0; i < this->_serverCount; i++) {
+    Server& server = this->_servers[i];
+    server.pending = false;
+    if (due < 0 || (long)(server.retryAt - this->_servers[due].retryAt) < 0) due = i;
+  }
+  bool sent = false;
+  for (uint8_t i = 0; i < this->_serverCount; i++) {
+    Server& server = this->_servers[i];
+    if (server.failures > 0 && (long)(now - server.retryAt) < 0 && i != due) continue;
+    if (!this->resolveServer(server)) {
+      if (server.resolve == RESOLVE_FAILED) this->backOff(server);
+      continue;                // Asked in a later round once its address is known
+    }
+    server.pending = this->sendNTPPacket(i);
+    if (server.pending) {
+      sent = true;
+    } else {
+      this->backOff(server);   // A server whose name does not resolve backs off like one that does not answer
     }
-    
-    if (timeout > 100) return false; // timeout after 1000 ms
-    timeout++;
-  } while (cb == 0);
+  }
+
+  this->_updating = sent;
+  return sent;
+}
+
+NTPUpdateStatus NTPClient::poll() {
+  if (!this->_updating) return NTP_UPDATE_IDLE;
+
+  this->receiveNTPPackets();
 
-  this->_lastUpdate = millis() - (10 * (timeout + 1)); // Account for delay in reading the time
+  bool waiting = false;
+  for (uint8_t i = 0; i < this->_serverCount; i++) {
+    waiting |= this->_servers[i].pending;
+  }
+  if (waiting && millis() - this->_requestSent < this->_timeout) return NTP_UPDATE_PENDING;
 
-  unsigned long highWord = word(this->_packetBuffer[40], this->_packetBuffer[41]);
-  unsigned long lowWord = word(this->_packetBuffer[42], this->_packetBuffer[43]);
-  // combine the four bytes (two words) into a long integer
-  // this is NTP time (seconds since Jan 1 1900):
-  unsigned long secsSince1900 = highWord << 16 | lowWord;
+  this->_updating = false;
+  return this->finishRound() ? NTP_UPDATE_SUCCESS : NTP_UPDATE_FAILED;
+}
 
-  this->_currentEpoc = secsSince1900 - SEVENZYYEARS;
+bool NTPClient::finishRound() {
+  // Servers still waiting for an answer failed this round
+  for (uint8_t i = 0; i < this->_serverCount; i++) {
+    Server& server = this->_servers[i];
+    if (!server.pending) continue;
+    server.pending = false;
+    this->backOff(server);
+  }
 
+  if (this->_bestServer < 0) return false;
+  this->_lastServer = this->_bestServer;
+  this->applySample(this->_bestNtpMs, this->_bestReceived, this->_bestDelay);
+  this->_bestServer = -1;
   return true;
 }
 
+void NTPClient::backOff(Server& server) {
+  if (server.failures < 255) server.failures++;
+  if (server.resolve != RESOLVE_PENDING) server.resolve = RESOLVE_NONE;   // Look the name up again, it may have moved
+  unsigned long skip = (unsigned long)NTP_BACKOFF_BASE << min(server.failures - 1, NTP_BACKOFF_MAX_SHIFT);
+  server.retryAt = millis() + skip;
+  #ifdef DEBUG_NTPClient
+    Serial.printf("NTP server %s failed, skipping it for %lu ms\n", server.name, skip);
+  #endif
+}
+
+bool NTPClient::resolveServer(Server& server) {
+  if (server.resolve == RESOLVE_DONE) return true;
+  if (server.resolve == RESOLVE_PENDING || server.resolve == RESOLVE_FAILED) return false;   // Failed ones back off first
+
+  if (server.address.fromString(server.name)) {
+    server.resolve = RESOLVE_DONE;
+    return true;
+  }
+#ifdef NTP_ASYNC_DNS
+  // Answers from the cache come back at once, others through dnsFound() on the lwIP thread
+  ip_addr_t addr;
+  server.resolve = RESOLVE_PENDING;
+  err_t err = dns_gethostbyname(server.name, &addr, (dns_found_callback)&NTPClient::dnsFound, &server);
+  if (err == ERR_OK) {
+    server.address = IPAddress(addr.u_addr.ip4.addr);
+    server.resolve = RESOLVE_DONE;
+    return true;
+  }
+  if (err != ERR_INPROGRESS) server.resolve = RESOLVE_FAILED;
+  return false;
+#else
+  // Without an asynchronous resolver UDP looks the name up on every request
+  server.resolve = RESOLVE_DONE;
+  server.address = IPAddress();
+  return true;
+#endif
+}
+
+#ifdef NTP_ASYNC_DNS
+void NTPClient::dnsFound(const char* name, const struct ip_addr* ipaddr, void* arg) {
+  Server* server = (Server*)arg;
+  if (ipaddr && ipaddr->u_addr.ip4.addr) {
+    server->address = IPAddress(ipaddr->u_addr.ip4.addr);
+    server->resolve = RESOLVE_DONE;
+  } else {
+    server->resolve = RESOLVE_FAILED;
+  }
+}
+#endif
+
+bool NTPClient::isUpdating() const {
+  return this->_updating;
+}
+
+int64_t NTPClient::readTimestampMs(const byte * field) {
+  // NTP timestamps are 32 bits of seconds since 1900 followed by 32 bits of fraction
+  uint32_t seconds  = (uint32_t)field[0] << 24 | (uint32_t)field[1] << 16 | (uint32_t)field[2] << 8 | field[3];
+  uint32_t fraction = (uint32_t)field[4] << 24 | (uint32_t)field[5] << 16 | (uint32_t)field[6] << 8 | field[7];
+  return (int64_t)seconds * 1000 + (((uint64_t)fraction * 1000) >> 32);
+}
+
+void NTPClient::receiveNTPPackets() {
+  // Drain every datagram that has arrived, a late answer to an earlier request may be queued first
+  while (this->_udp->parsePacket() > 0) {
+    unsigned long received = millis();
+    if (this->_udp->read(this->_packetBuffer, NTP_PACKET_SIZE) != NTP_PACKET_SIZE) continue;
+    if (!this->isValid(this->_packetBuffer)) continue;
+
+    // The server echoes our transmit timestamp as the originate timestamp, which identifies the answer.
+    // Its seconds hold the send time and the first fraction byte the server index.
+    uint32_t originate = (uint32_t)this->_packetBuffer[24] << 24 | (uint32_t)this->_packetBuffer[25] << 16 |
+                         (uint32_t)this->_packetBuffer[26] << 8 | this->_packetBuffer[27];
+    uint8_t index = this->_packetBuffer[28];
+    if (index >= this->_serverCount) continue;
+    Server& server = this->_servers[index];
+    if (!server.pending || originate != server.requestSent) continue;
+
+    // T1 and T4 are local send and receive times relative to the send, T2 and T3 the server receive and transmit times
+    int64_t t4 = (int64_t)(received - server.requestSent);
+    int64_t t2 = readTimestampMs(this->_packetBuffer + 32);
+    int64_t t3 = readTimestampMs(this->_packetBuffer + 40);
+
+    int64_t roundTrip = t4 - (t3 - t2);
+    if (roundTrip < 0) roundTrip = 0;
+    int64_t offset = ((t2 - 0) + (t3 - t4)) / 2;     // Server time at the moment the request was sent
+    int64_t nowMs  = offset + t4 - (int64_t)SEVENZYYEARS * 1000;
+
+    server.pending  = false;
+    server.failures = 0;
+    server.retryAt  = 0;
+
+    // The shortest round trip leaves the least room for asymmetric network delay
+    if (this->_bestServer < 0 || roundTrip < this->_bestDelay) {
+      this->_bestServer   = index;
+      this->_bestNtpMs    = nowMs;
+      this->_bestReceived = received;
+      this->_bestDelay    = (long)roundTrip;
+    }
+  }
+}
+
+void NTPClient::applySample(int64_t nowMs, unsigned long received, long roundTrip) {
+  if (this->_lastUpdate != 0) {
+    this->_lastOffset = (long)(nowMs - this->localEpochMs(received));
+  }
+  this->_lastDelay = roundTrip;
+  this->updateDrift(nowMs, received);
+
+  // Keep whole seconds in _currentEpoc and fold the fraction into _lastUpdate
+  this->_currentEpoc = (unsigned long)(nowMs / 1000);
+  this->_lastUpdate  = received - (unsigned long)(nowMs % 1000);
+}
+
 bool NTPClient::update() {
   if ((millis() - this->_lastUpdate >= this->_updateInterval)     // Update after _updateInterval
     || this->_lastUpdate == 0) {                                // Update if there was no update yet.
-    if (!this->_udpSetup) this->begin();                         // setup the UDP client if needed
     return this->forceUpdate();
   }
   return true;
 }
 
+void NTPClient::setTimeout(unsigned long timeout) {
+  this->_timeout = timeout;
+}
+
+long NTPClient::getLastDelay() const {
+  return this->_lastDelay;
+}
+
+long NTPClient::getLastOffset() const {
+  return this->_lastOffset;
+}
+
+const char* NTPClient::getLastServer() const {
+  return this->_lastServer < 0 ? NULL : this->_servers[this->_lastServer].name;
+}
+
+uint8_t NTPClient::getServerFailures(uint8_t index) const {
+  return index < this->_serverCount ? this->_servers[index].failures : 0;
+}
+
+void NTPClient::updateDrift(int64_t nowMs, unsigned long received) {
+  if (this->_driftSamples == 0 && this->_driftRefLocal == 0) {
+    this->_driftRefNtpMs = nowMs;
+    this->_driftRefLocal = received;
+    return;
+  }
+
+  // Short intervals are dominated by network jitter, wait for a longer baseline
+  unsigned long localElapsed = received - this->_driftRefLocal;
+  if (localElapsed < NTP_DRIFT_MIN_INTERVAL) return;
+
+  int64_t ntpElapsed = nowMs - this->_driftRefNtpMs;
+  float measured = (float)(ntpElapsed - (int64_t)localElapsed) * 1e6f / localElapsed;
+  this->_driftRefNtpMs = nowMs;
+  this->_driftRefLocal = received;
+  if (measured > NTP_DRIFT_MAX_PPM || measured < -NTP_DRIFT_MAX_PPM) return;
+
+  // Exponential average, first samples weigh more so the estimate settles quickly
+  if (this->_driftSamples < 4) this->_driftSamples++;
+  this->_driftPpm += (measured - this->_driftPpm) / this->_driftSamples;
+}
+
+int64_t NTPClient::localEpochMs(unsigned long at) {
+  unsigned long elapsed = at - this->_lastUpdate;
+  return (int64_t)this->_currentEpoc * 1000 + elapsed + (int64_t)(elapsed * this->_driftPpm / 1e6f);
+}
+
+uint64_t NTPClient::getEpochMillis() {
+  return (int64_t)this->_timeOffset * 1000 + // User offset
+         this->localEpochMs(millis());       // Epoc returned by the NTP server plus time since last update
+}
+
+float NTPClient::getDriftPpm() const {
+  return this->_driftPpm;
+}
+
 unsigned long NTPClient::getEpochTime() {
-  return this->_timeOffset + // User offset
-         this->_currentEpoc + // Epoc returned by the NTP server
-         ((millis() - this->_lastUpdate) / 1000); // Time since last update
+  return this->getEpochMillis() / 1000;
 }
 
 int NTPClient::getDay() {
@@ -152,45 +389,59 @@ int NTPClient::getSeconds() {
   return (this->getEpochTime() % 60);
 }
 
-String NTPClient::getFormattedTime(unsigned long secs) {
-  unsigned long rawTime = secs ? secs : this->getEpochTime();
-  unsigned long hours = (rawTime % 86400L) / 3600;
-  String hoursStr = hours < 10 ? "0" + String(hours) : String(hours);
-
-  unsigned long minutes = (rawTime % 3600) / 60;
-  String minuteStr = minutes < 10 ? "0" + String(minutes) : String(minutes);
+// Writes value as two digits
+static char * putTwoDigits(char * p, unsigned long value) {
+  *p++ = '0' + value / 10;
+  *p++ = '0' + value % 10;
+  return p;
+}
 
-  unsigned long seconds = rawTime % 60;
-  String secondStr = seconds < 10 ? "0" + String(seconds) : String(seconds);
+static char * putTime(char * p, unsigned long rawTime) {
+  p = putTwoDigits(p, (rawTime % 86400L) / 3600);
+  *p++ = ':';
+  p = putTwoDigits(p, (rawTime % 3600) / 60);
+  *p++ = ':';
+  return putTwoDigits(p, rawTime % 60);
+}
 
-  return hoursStr + ":" + minuteStr + ":" + secondStr;
+size_t NTPClient::formatTime(char * buf, size_t len, unsigned long secs) {
+  if (len < NTP_FORMATTED_TIME_SIZE) return 0;
+  unsigned long rawTime = secs ? secs : this->getEpochTime();
+  char * end = putTime(buf, rawTime);
+  *end = '\0';
+  return end - buf;
 }
 
-// Based on https://github.com/PaulStoffregen/Time/blob/master/Time.cpp
 // currently assumes UTC timezone, instead of using this->_timeOffset
+size_t NTPClient::formatDate(char * buf, size_t len, unsigned long secs) {
+  if (len < NTP_FORMATTED_DATE_SIZE) return 0;
+  unsigned long rawTime = secs ? secs : this->getEpochTime();
+  NTPDate date = civilFromDays(rawTime / 86400L);
+
+  char * p = buf;
+  p = putTwoDigits(p, date.year / 100);
+  p = putTwoDigits(p, date.year % 100);
+  *p++ = '-';
+  p = putTwoDigits(p, date.month);
+  *p++ = '-';
+  p = putTwoDigits(p, date.day);
+  *p++ = 'T';
+  p = putTime(p, rawTime);
+  *p++ = 'Z';
+  *p = '\0';
+  return p - buf;
+}
+
+String NTPClient::getFormattedTime(unsigned long secs) {
+  char buf[NTP_FORMATTED_TIME_SIZE];
+  this->formatTime(buf, sizeof(buf), secs);
+  return String(buf);
+}
+
 String NTPClient::getFormattedDate(unsigned long secs) {
-  unsigned long rawTime = (secs ? secs : this->getEpochTime()) / 86400L;  // in days
-  unsigned long days = 0, year = 1970;
-  uint8_t month;
-  static const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31};
-
-  while((days += (LEAP_YEAR(year) ? 366 : 365)) <= rawTime)
-    year++;
-  rawTime -= days - (LEAP_YEAR(year) ? 366 : 365); // now it is days in this year, starting at 0
-  days=0;
-  for (month=0; month<12; month++) {
-    uint8_t monthLength;
-    if (month==1) { // february
-      monthLength = LEAP_YEAR(year) ? 29 : 28;
-    } else {
-      monthLength = monthDays[month];
-    }
-    if (rawTime < monthLength) break;
-    rawTime -= monthLength;
-  }
-  String monthStr = ++month < 10 ? "0" + String(month) : String(month); // jan is month 1  
-  String dayStr = ++rawTime < 10 ? "0" + String(rawTime) : String(rawTime); // day of month  
-  return String(year) + "-" + monthStr + "-" + dayStr + "T" + this->getFormattedTime(secs ? secs : 0) + "Z";
+  char buf[NTP_FORMATTED_DATE_SIZE];
+  this->formatDate(buf, sizeof(buf), secs);
+  return String(buf);
 }
 
 void NTPClient::end() {
@@ -207,7 +458,7 @@ void NTPClient::setUpdateInterval(unsigned long updateInterval) {
   this->_updateInterval = updateInterval;
 }
 
-void NTPClient::sendNTPPacket() {
+bool NTPClient::sendNTPPacket(uint8_t server) {
   // set all bytes in the buffer to 0
   memset(this->_packetBuffer, 0, NTP_PACKET_SIZE);
   // Initialize values needed to form NTP request
@@ -222,11 +473,24 @@ void NTPClient::sendNTPPacket() {
   this->_packetBuffer[14]  = 0x49;
   this->_packetBuffer[15]  = 0x52;
 
+  // Transmit timestamp, the server returns it as originate timestamp. Only used to match the answer.
+  unsigned long sent = millis();
+  this->_servers[server].requestSent = sent;
+  this->_packetBuffer[40]  = sent >> 24;
+  this->_packetBuffer[41]  = sent >> 16;
+  this->_packetBuffer[42]  = sent >> 8;
+  this->_packetBuffer[43]  = sent;
+  this->_packetBuffer[44]  = server;
+
   // all NTP fields have been given values, now
   // you can send a packet requesting a timestamp:
-  this->_udp->beginPacket(this->_poolServerName, 123); //NTP requests are to port 123
+  //NTP requests are to port 123
+  const Server& target = this->_servers[server];
+  int began = (uint32_t)target.address ? this->_udp->beginPacket(target.address, 123)
+                                       : this->_udp->beginPacket(target.name, 123);
+  if (!began) return false;
   this->_udp->write(this->_packetBuffer, NTP_PACKET_SIZE);
-  this->_udp->endPacket();
+  return this->_udp->endPacket();
 }
 
 void NTPClient::setEpochTime(unsigned long secs) {
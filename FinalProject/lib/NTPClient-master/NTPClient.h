@@ -4,18 +4,67 @@
 
 #include <Udp.h>
 
+#if defined(ARDUINO_ARCH_ESP32)
+// Server names are resolved with the asynchronous lwIP resolver instead of on every request
+#define NTP_ASYNC_DNS
+struct ip_addr;
+#endif
+
 #define SEVENZYYEARS 2208988800UL
 #define NTP_PACKET_SIZE 48
 #define NTP_DEFAULT_LOCAL_PORT 1337
+#define NTP_DEFAULT_TIMEOUT 1000
+#define NTP_DRIFT_MIN_INTERVAL 10000    // Shortest time between syncs used to measure drift, in ms
+#define NTP_DRIFT_MAX_PPM 500           // Larger measured drift is treated as a bad sample
+#define NTP_MAX_SERVERS 4
+#define NTP_BACKOFF_BASE 16000          // Time a server is skipped after its first failure, in ms
+#define NTP_BACKOFF_MAX_SHIFT 8         // The skip time doubles per failure up to BASE << MAX_SHIFT
 #define LEAP_YEAR(Y)     ( (Y>0) && !(Y%4) && ( (Y%100) || !(Y%400) ) )
+#define NTP_FORMATTED_DATE_SIZE 21  // `2004-02-12T15:19:21Z` and the terminating NUL
+#define NTP_FORMATTED_TIME_SIZE 9   // `15:19:21` and the terminating NUL
+
+/**
+ * A day in the Gregorian calendar
+ */
+struct NTPDate {
+  uint16_t year;
+  uint8_t  month;  // 1 to 12
+  uint8_t  day;    // 1 to 31
+};
+
 
+enum NTPUpdateStatus {
+  NTP_UPDATE_IDLE,     // No request in flight
+  NTP_UPDATE_PENDING,  // Waiting for the server to answer
+  NTP_UPDATE_SUCCESS,  // The answer arrived and the time was updated
+  NTP_UPDATE_FAILED    // The request could not be sent or timed out
+};
 
 class NTPClient {
   private:
+    enum Resolve : uint8_t {
+      RESOLVE_NONE,                 // Address not known, looked up before the next request
+      RESOLVE_PENDING,              // Lookup in progress
+      RESOLVE_DONE,                 // Address known
+      RESOLVE_FAILED                // Lookup failed, the server backs off
+    };
+
+    struct Server {
+      const char*   name;
+      IPAddress     address;        // Cached address of name, valid once resolve is RESOLVE_DONE
+      volatile Resolve resolve;     // Set from the lwIP thread by the resolver callback
+      bool          pending;        // A request of the current round is waiting for an answer
+      unsigned long requestSent;    // millis() when that request was sent
+      uint8_t       failures;       // Consecutive rounds without an answer
+      unsigned long retryAt;        // millis() until which the server is skipped after failing
+    };
+
     UDP*          _udp;
     bool          _udpSetup       = false;
 
-    const char*   _poolServerName = "pool.ntp.org"; // Default time server
+    Server        _servers[NTP_MAX_SERVERS];
+    uint8_t       _serverCount    = 0;
+    int8_t        _lastServer     = -1;     // Server whose answer set the clock last
     int           _port           = NTP_DEFAULT_LOCAL_PORT;
     int           _timeOffset     = 0;
 
@@ -24,10 +73,63 @@ class NTPClient {
     unsigned long _currentEpoc    = 0;      // In s
     unsigned long _lastUpdate     = 0;      // In ms
 
+    unsigned long _timeout        = NTP_DEFAULT_TIMEOUT; // In ms
+    bool          _updating       = false;
+    unsigned long _requestSent    = 0;      // millis() when the pending round of requests was sent
+
+    int8_t        _bestServer     = -1;     // Answer of the pending round with the lowest delay so far
+    int64_t       _bestNtpMs      = 0;
+    unsigned long _bestReceived   = 0;
+    long          _bestDelay      = 0;
+    long          _lastDelay      = 0;      // Round-trip delay of the last exchange, in ms
+    long          _lastOffset     = 0;      // Correction applied by the last exchange, in ms
+
+    float         _driftPpm       = 0;      // Local clock error, positive when millis() runs slow
+    uint8_t       _driftSamples   = 0;
+    int64_t       _driftRefNtpMs  = 0;      // Server time of the sync drift is measured from
+    unsigned long _driftRefLocal  = 0;      // millis() at that sync
+
     byte          _packetBuffer[NTP_PACKET_SIZE];
 
-    void          sendNTPPacket();
+    void          setServers(const char* const* serverNames, uint8_t serverCount);
+    bool          sendNTPPacket(uint8_t server);
     bool          isValid(byte * ntpPacket);
+    void          receiveNTPPackets();
+    bool          finishRound();
+    void          backOff(Server& server);
+    bool          resolveServer(Server& server);
+#ifdef NTP_ASYNC_DNS
+    static void   dnsFound(const char* name, const struct ip_addr* ipaddr, void* arg);
+#endif
+    void          applySample(int64_t nowMs, unsigned long received, long roundTrip);
+    static int64_t readTimestampMs(const byte * field);
+
+    // Steps of civilFromDays(), split up to stay within C++11 constexpr rules.
+    // Years start on March 1st here so the leap day is the last day of the year.
+    static constexpr unsigned long yearOfEra(unsigned long dayOfEra) {
+      return (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    }
+    static constexpr unsigned long dayOfYear(unsigned long dayOfEra, unsigned long yearOfEra) {
+      return dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    }
+    static constexpr NTPDate civilFromMonthIndex(unsigned long year, unsigned long dayOfYear, unsigned long monthIndex) {
+      return NTPDate{ (uint16_t)(year + (monthIndex >= 10)),
+                      (uint8_t)(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9),
+                      (uint8_t)(dayOfYear - (153 * monthIndex + 2) / 5 + 1) };
+    }
+    static constexpr NTPDate civilFromDayOfEra(unsigned long era, unsigned long dayOfEra) {
+      return civilFromMonthIndex(era * 400 + yearOfEra(dayOfEra),
+                                 dayOfYear(dayOfEra, yearOfEra(dayOfEra)),
+                                 (5 * dayOfYear(dayOfEra, yearOfEra(dayOfEra)) + 2) / 153);
+    }
+    static constexpr unsigned long daysFromMarchYear(unsigned long year, unsigned month, unsigned day) {
+      return (year / 400) * 146097 +
+             (year % 400) * 365 + (year % 400) / 4 - (year % 400) / 100 +
+             (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1 -
+             719468;
+    }
+    int64_t       localEpochMs(unsigned long at);
+    void          updateDrift(int64_t nowMs, unsigned long received);
 
   public:
     NTPClient(UDP& udp);
@@ -36,6 +138,15 @@ class NTPClient {
     NTPClient(UDP& udp, const char* poolServerName, int timeOffset);
     NTPClient(UDP& udp, const char* poolServerName, int timeOffset, unsigned long updateInterval);
 
+    /**
+     * Queries every server in the list at once and keeps the answer with the lowest round-trip delay.
+     * Servers that do not answer are skipped for a time that doubles with every failure.
+     * Names are resolved once and the address is cached until the server fails. On ESP32 the lookup
+     * does not block: a server is first asked in the round after its address is known.
+     * At most NTP_MAX_SERVERS are used, the list must stay valid for the lifetime of the client.
+     */
+    NTPClient(UDP& udp, const char* const* serverNames, uint8_t serverCount, int timeOffset, unsigned long updateInterval);
+
     /**
      * Starts the underlying UDP client with the default local port
      */
@@ -55,12 +166,59 @@ class NTPClient {
     bool update();
 
     /**
-     * This will force the update from the NTP Server.
+     * This will force the update from the NTP Server. Blocks until the answer arrives or the request times out,
+     * use beginUpdate() and poll() to avoid waiting.
      *
      * @return true on success, false on failure
      */
     bool forceUpdate();
 
+    /**
+     * Sends a request to every server not backing off and returns immediately. Call poll() afterwards to
+     * collect the answers. If every server is backing off the one due first is asked anyway.
+     *
+     * @return true if at least one request was sent
+     */
+    bool beginUpdate();
+
+    /**
+     * Checks for answers to the requests started with beginUpdate(). Never waits. The round ends once
+     * every server asked has answered or the timeout has passed, the answer with the lowest delay is used.
+     *
+     * @return NTP_UPDATE_PENDING until the round ends
+     */
+    NTPUpdateStatus poll();
+
+    /**
+     * @return true while a request started with beginUpdate() is waiting for an answer
+     */
+    bool isUpdating() const;
+
+    /**
+     * Sets how long to wait for an answer, in ms
+     */
+    void setTimeout(unsigned long timeout);
+
+    /**
+     * @return round-trip delay of the last successful exchange in ms, not counting server processing time
+     */
+    long getLastDelay() const;
+
+    /**
+     * @return correction in ms the last successful exchange applied to the local clock
+     */
+    long getLastOffset() const;
+
+    /**
+     * @return name of the server whose answer set the clock last, NULL before the first update
+     */
+    const char* getLastServer() const;
+
+    /**
+     * @return number of rounds in a row the server at index has not answered
+     */
+    uint8_t getServerFailures(uint8_t index) const;
+
     int getDay();
     int getHours();
     int getMinutes();
@@ -86,6 +244,16 @@ class NTPClient {
      * @return time in seconds since Jan. 1, 1970
      */
     unsigned long getEpochTime();
+
+    /**
+     * @return time in milliseconds since Jan. 1, 1970, corrected for the measured drift of the local clock
+     */
+    uint64_t getEpochMillis();
+
+    /**
+     * @return measured error of the local clock in parts per million, positive when it runs slow
+     */
+    float getDriftPpm() const;
   
     /**
     * @return secs argument (or 0 for current date) formatted to ISO 8601
@@ -93,6 +261,34 @@ class NTPClient {
     */
     String getFormattedDate(unsigned long secs = 0);
 
+    /**
+    * Writes secs argument (or 0 for current time) formatted like `hh:mm:ss` into buf, without allocating
+    *
+    * @return number of characters written, 0 if len is less than NTP_FORMATTED_TIME_SIZE
+    */
+    size_t formatTime(char * buf, size_t len, unsigned long secs = 0);
+
+    /**
+    * Writes secs argument (or 0 for current date) formatted like `2004-02-12T15:19:21Z` into buf, without allocating
+    *
+    * @return number of characters written, 0 if len is less than NTP_FORMATTED_DATE_SIZE
+    */
+    size_t formatDate(char * buf, size_t len, unsigned long secs = 0);
+
+    /**
+    * @return days since Jan. 1, 1970 of a date from that day on
+    */
+    static constexpr unsigned long daysFromCivil(unsigned year, unsigned month, unsigned day) {
+      return daysFromMarchYear(year - (month <= 2), month, day);
+    }
+
+    /**
+    * @return the date a number of days after Jan. 1, 1970
+    */
+    static constexpr NTPDate civilFromDays(unsigned long days) {
+      return civilFromDayOfEra((days + 719468) / 146097, (days + 719468) % 146097);
+    }
+
     /**
      * Stops the underlying UDP client
      */
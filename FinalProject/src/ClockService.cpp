@@ -0,0 +1,73 @@
+/**
+ * @file ClockService.cpp
+ * @brief Wall-clock time kept locally and corrected from NTP now and then.
+ */
+
+#include "ClockService.h"
+#include <esp_timer.h>
+
+ClockService::ClockService(NTPClient &ntp, unsigned long syncInterval, unsigned long maxSyncInterval, unsigned long retryInterval)
+  : _ntp(ntp), _syncInterval(syncInterval), _maxSyncInterval(max(syncInterval, maxSyncInterval)),
+    _currentInterval(syncInterval), _retryInterval(retryInterval) {
+}
+
+int64_t ClockService::monotonicMs() {
+  return esp_timer_get_time() / 1000;
+}
+
+bool ClockService::update() {
+  // Never waits on the network: the request is sent on one call and the answer
+  // collected on a later one.
+  if (_ntp.isUpdating()) {
+    NTPUpdateStatus status = _ntp.poll();
+    if (status == NTP_UPDATE_PENDING) {
+      return false;
+    }
+    _lastAttemptOk = status == NTP_UPDATE_SUCCESS;
+    if (!_lastAttemptOk) {
+      return false;
+    }
+    apply();
+    return true;
+  }
+
+  unsigned long wait = _lastAttemptOk ? _currentInterval : _retryInterval;
+  if (_lastAttempt != 0 && millis() - _lastAttempt < wait) {
+    return false;
+  }
+  _lastAttempt = millis();
+  _lastAttemptOk = _ntp.beginUpdate();
+  return false;
+}
+
+void ClockService::apply() {
+  int64_t epochMs = _ntp.getEpochMillis();
+  int64_t monoMs = monotonicMs();
+
+  if (_synced) {
+    long correction = _ntp.getLastOffset();
+    if (correction <= STABLE_CORRECTION_MS && correction >= -STABLE_CORRECTION_MS) {
+      _currentInterval = min(_currentInterval * 2, _maxSyncInterval);
+    } else {
+      _currentInterval = _syncInterval;
+    }
+  }
+
+  portENTER_CRITICAL(&_mux);
+  _anchorEpochMs = epochMs;
+  _anchorMonoMs = monoMs;
+  _driftPpm = _ntp.getDriftPpm();
+  portEXIT_CRITICAL(&_mux);
+  _synced = true;
+}
+
+uint64_t ClockService::nowMs() const {
+  portENTER_CRITICAL(&_mux);
+  int64_t anchorEpochMs = _anchorEpochMs;
+  int64_t anchorMonoMs = _anchorMonoMs;
+  float driftPpm = _driftPpm;
+  portEXIT_CRITICAL(&_mux);
+
+  int64_t elapsed = monotonicMs() - anchorMonoMs;
+  return anchorEpochMs + elapsed + (int64_t)(elapsed * driftPpm / 1e6f);
+}
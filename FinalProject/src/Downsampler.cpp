@@ -0,0 +1,147 @@
+/**
+ * @file Downsampler.cpp
+ * @brief Min/max/average bucketing of a sample range down to a fixed number of points.
+ */
+
+#include "Downsampler.h"
+
+Downsampler::Downsampler(uint32_t total, uint32_t points) {
+  if (points == 0) {
+    points = 1;
+  }
+  _bucketSize = (total + points - 1) / points;
+  if (_bucketSize == 0) {
+    _bucketSize = 1;
+  }
+}
+
+bool Downsampler::add(const Sample &sample, SampleBucket &out) {
+  if (_count == 0) {
+    _min = sample.centiC;
+    _max = sample.centiC;
+  } else {
+    _min = min(_min, sample.centiC);
+    _max = max(_max, sample.centiC);
+  }
+  _epochSum += sample.epoch;
+  _tempSum += sample.centiC;
+  _sensor = sample.sensor;
+  _count++;
+
+  if (_count < _bucketSize) {
+    return false;
+  }
+  emit(out);
+  return true;
+}
+
+bool Downsampler::flush(SampleBucket &out) {
+  if (_count == 0) {
+    return false;
+  }
+  emit(out);
+  return true;
+}
+
+void Downsampler::emit(SampleBucket &out) {
+  out.epoch = _epochSum / _count;
+  out.minC = _min;
+  out.maxC = _max;
+  out.avgC = (int16_t)(_tempSum / (int64_t)_count);
+  out.count = _count;
+  out.sensor = _sensor;
+
+  _count = 0;
+  _epochSum = 0;
+  _tempSum = 0;
+}
+
+DownsampledExporter::DownsampledExporter(SampleStore &store, uint32_t from, uint32_t to, uint32_t points, uint32_t sensor, uint8_t sensors)
+  : _store(store), _sensor(sensor) {
+  _index = _store.seek(from);
+  _end = to == UINT32_MAX ? _store.size() : _store.seek(to + 1);
+  if (_end < _index) {
+    _end = _index;
+  }
+
+  // Sensors are sampled together, so each one holds its share of the range.
+  uint32_t perSensor = (_end - _index) / max(sensors, (uint8_t)1);
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    _downsamplers[i] = Downsampler(perSensor, points);
+  }
+}
+
+bool DownsampledExporter::nextRow() {
+  if (!_headerDone) {
+    static const char header[] = "Time,Sensor,Temperature,Min,Max\n";
+    _headerDone = true;
+    memcpy(_row, header, sizeof(header));
+    _rowLen = sizeof(header) - 1;
+    _rowPos = 0;
+    return true;
+  }
+
+  SampleBucket bucket;
+  bool done = false;
+  while (!done) {
+    if (_batchPos == _batchLen) {
+      if (_index >= _end) {
+        break;
+      }
+      _batchLen = _store.read(_index, _batch, min((uint32_t)BATCH_SIZE, _end - _index));
+      _batchPos = 0;
+      if (_batchLen == 0) {
+        _index = _end;
+        break;
+      }
+      _index += _batchLen;
+    }
+
+    const Sample &sample = _batch[_batchPos++];
+    if (sample.sensor >= MAX_SENSORS || (_sensor != UINT32_MAX && sample.sensor != _sensor)) {
+      continue;
+    }
+    done = _downsamplers[sample.sensor].add(sample, bucket);
+  }
+
+  // Once the range is read, the partly filled buckets follow.
+  while (!done && _flushed < MAX_SENSORS) {
+    done = _downsamplers[_flushed++].flush(bucket);
+  }
+  if (!done) {
+    return false;
+  }
+  _rowLen = formatRow(bucket, _row, sizeof(_row));
+  _rowPos = 0;
+  return true;
+}
+
+size_t DownsampledExporter::fill(uint8_t *buf, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    // Rows that do not fit are carried over to the next call.
+    if (_rowPos == _rowLen && !nextRow()) {
+      break;
+    }
+    size_t n = min(_rowLen - _rowPos, maxLen - written);
+    memcpy(buf + written, _row + _rowPos, n);
+    _rowPos += n;
+    written += n;
+  }
+  return written;
+}
+
+size_t DownsampledExporter::formatRow(const SampleBucket &bucket, char *buf, size_t len) {
+  if (len < SAMPLE_ROW_MAX) {
+    return 0;
+  }
+  char timestamp[TIMESTAMP_MAX];
+  char avg[CENTIC_MAX];
+  char low[CENTIC_MAX];
+  char high[CENTIC_MAX];
+  formatTimestamp(bucket.epoch, timestamp, sizeof(timestamp));
+  formatCentiC(bucket.avgC, avg, sizeof(avg));
+  formatCentiC(bucket.minC, low, sizeof(low));
+  formatCentiC(bucket.maxC, high, sizeof(high));
+  return snprintf(buf, len, "%s,%u,%s,%s,%s\n", timestamp, bucket.sensor, avg, low, high);
+}
@@ -0,0 +1,197 @@
+/**
+ * @file SampleExport.cpp
+ * @brief Streaming CSV/NDJSON encoder for a time range of the sample store.
+ */
+
+#include "SampleExport.h"
+#include <NTPClient.h>
+
+SampleExporter::SampleExporter(SampleStore &store, ExportFormat format, uint32_t from, uint32_t to)
+  : _store(store), _format(format) {
+  _index = _store.seek(from);
+  _end = to == UINT32_MAX ? _store.size() : _store.seek(to + 1);
+  if (_end < _index) {
+    _end = _index;
+  }
+}
+
+bool SampleExporter::nextRow() {
+  if (!_headerDone) {
+    _headerDone = true;
+    _rowLen = formatHeader(_format, _row, sizeof(_row));
+    _rowPos = 0;
+    if (_rowLen) {
+      return true;
+    }
+  }
+
+  if (_batchPos == _batchLen) {
+    if (_index >= _end) {
+      return false;
+    }
+    _batchLen = _store.read(_index, _batch, min((uint32_t)BATCH_SIZE, _end - _index));
+    _batchPos = 0;
+    if (_batchLen == 0) {
+      _index = _end;
+      return false;
+    }
+    _index += _batchLen;
+  }
+
+  _rowLen = formatRow(_format, _batch[_batchPos++], _row, sizeof(_row));
+  _rowPos = 0;
+  return true;
+}
+
+size_t SampleExporter::fill(uint8_t *buf, size_t maxLen) {
+  size_t written = 0;
+  while (written < maxLen) {
+    // Rows that do not fit are carried over to the next call.
+    if (_rowPos == _rowLen && !nextRow()) {
+      break;
+    }
+    size_t n = min(_rowLen - _rowPos, maxLen - written);
+    memcpy(buf + written, _row + _rowPos, n);
+    _rowPos += n;
+    written += n;
+  }
+  return written;
+}
+
+size_t SampleExporter::formatHeader(ExportFormat format, char *buf, size_t len) {
+  static const char csvHeader[] = "Time,Sensor,Temperature\n";
+  if (format != ExportFormat::CSV || len < sizeof(csvHeader)) {
+    return 0;
+  }
+  memcpy(buf, csvHeader, sizeof(csvHeader));
+  return sizeof(csvHeader) - 1;
+}
+
+namespace {
+  // Formatting helpers for buffers already known to be large enough. Each
+  // returns the position after the text it wrote.
+
+  char *putText(char *p, const char *text) {
+    while (*text) {
+      *p++ = *text++;
+    }
+    return p;
+  }
+
+  char *putDigits(char *p, uint32_t value, uint8_t width) {
+    for (int i = width - 1; i >= 0; i--) {
+      p[i] = '0' + value % 10;
+      value /= 10;
+    }
+    return p + width;
+  }
+
+  char *putUInt(char *p, uint32_t value) {
+    uint8_t width = 1;
+    for (uint32_t rest = value / 10; rest; rest /= 10) {
+      width++;
+    }
+    return putDigits(p, value, width);
+  }
+
+  char *putTimestamp(char *p, uint32_t epoch) {
+    NTPDate date = NTPClient::civilFromDays(epoch / 86400);
+    p = putDigits(p, date.year, 4);
+    *p++ = '-';
+    p = putDigits(p, date.month, 2);
+    *p++ = '-';
+    p = putDigits(p, date.day, 2);
+    *p++ = ' ';
+    p = putDigits(p, epoch % 86400 / 3600, 2);
+    *p++ = ':';
+    p = putDigits(p, epoch % 3600 / 60, 2);
+    *p++ = ':';
+    return putDigits(p, epoch % 60, 2);
+  }
+
+  char *putCentiC(char *p, int16_t centiC) {
+    // Integer formatting keeps the output exact and free of float rounding.
+    int32_t value = centiC;
+    if (value < 0) {
+      *p++ = '-';
+      value = -value;
+    }
+    p = putUInt(p, value / 100);
+    *p++ = '.';
+    return putDigits(p, value % 100, 2);
+  }
+
+  uint8_t *putLE(uint8_t *p, uint64_t value, uint8_t width) {
+    for (uint8_t i = 0; i < width; i++) {
+      *p++ = (uint8_t)(value >> (8 * i));
+    }
+    return p;
+  }
+}
+
+size_t SampleExporter::formatRow(ExportFormat format, const Sample &sample, char *buf, size_t len) {
+  if (len < SAMPLE_ROW_MAX) {
+    return 0;
+  }
+
+  char *p = buf;
+  if (format == ExportFormat::CSV) {
+    p = putTimestamp(p, sample.epoch);
+    *p++ = ',';
+    p = putUInt(p, sample.sensor);
+    *p++ = ',';
+    p = putCentiC(p, sample.centiC);
+  } else {
+    p = putText(p, "{\"time\":\"");
+    p = putTimestamp(p, sample.epoch);
+    p = putText(p, "\",\"epoch\":");
+    p = putUInt(p, sample.epoch);
+    p = putText(p, ",\"sensor\":");
+    p = putUInt(p, sample.sensor);
+    p = putText(p, ",\"temperature\":");
+    p = putCentiC(p, sample.centiC);
+    *p++ = '}';
+  }
+  *p++ = '\n';
+  *p = '\0';
+  return p - buf;
+}
+
+size_t formatTimestamp(uint32_t epoch, char *buf, size_t len) {
+  if (len < TIMESTAMP_MAX) {
+    return 0;
+  }
+  char *end = putTimestamp(buf, epoch);
+  *end = '\0';
+  return end - buf;
+}
+
+size_t formatCentiC(int16_t centiC, char *buf, size_t len) {
+  if (len < CENTIC_MAX) {
+    return 0;
+  }
+  char *end = putCentiC(buf, centiC);
+  *end = '\0';
+  return end - buf;
+}
+
+size_t encodeSampleFrame(const Sample *samples, size_t count, uint8_t *buf, size_t len) {
+  if (count == 0 || count > SAMPLE_FRAME_MAX_SAMPLES || len < SAMPLE_FRAME_HEADER + count * SAMPLE_FRAME_RECORD) {
+    return 0;
+  }
+  uint64_t baseMs = (uint64_t)samples[0].epoch * 1000;
+
+  uint8_t *p = buf;
+  *p++ = SAMPLE_FRAME_VERSION;
+  *p++ = (uint8_t)count;
+  p = putLE(p, SAMPLE_FRAME_RECORD, 2);
+  p = putLE(p, baseMs, 8);
+  for (size_t i = 0; i < count; i++) {
+    int32_t offsetMs = (int32_t)((int64_t)samples[i].epoch * 1000 - (int64_t)baseMs);
+    p = putLE(p, (uint32_t)offsetMs, 4);
+    *p++ = samples[i].sensor;
+    *p++ = 0;
+    p = putLE(p, (uint16_t)samples[i].centiC, 2);
+  }
+  return p - buf;
+}
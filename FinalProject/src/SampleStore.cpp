@@ -0,0 +1,356 @@
+/**
+ * @file SampleStore.cpp
+ * @brief Fixed-size binary ring buffer of temperature samples kept on a file system.
+ */
+
+#include "SampleStore.h"
+
+namespace {
+  // The store is appended to from the storage task and read from the async_tcp task.
+  class StoreLock {
+    public:
+      explicit StoreLock(SemaphoreHandle_t lock) : _lock(lock) { xSemaphoreTake(_lock, portMAX_DELAY); }
+      ~StoreLock() { xSemaphoreGive(_lock); }
+    private:
+      SemaphoreHandle_t _lock;
+  };
+}
+
+const uint32_t SampleStore::RECORDS_PER_PAGE;
+
+SampleStore::SampleStore(fs::FS &fs, const char *path, uint32_t capacity)
+  : _fs(fs), _path(path), _capacity(capacity) {
+  _lock = xSemaphoreCreateMutex();
+}
+
+bool SampleStore::begin() {
+  StoreLock guard(_lock);
+
+  if (_fs.exists(_path)) {
+    _file = _fs.open(_path, "r+");
+  }
+  if (!_file) {
+    return create();
+  }
+
+  Header header;
+  _file.seek(0);
+  if (_file.read((uint8_t *)&header, sizeof(header)) != sizeof(header)
+      || header.magic != MAGIC
+      || header.version < MIN_VERSION
+      || header.version > VERSION
+      || header.recordSize != sizeof(Sample)
+      || header.capacity != _capacity
+      || header.head >= _capacity
+      || header.count > _capacity) {
+    // Keep whatever is there for inspection instead of overwriting it.
+    _file.close();
+    String backup = String(_path) + ".bak";
+    _fs.remove(backup.c_str());
+    _fs.rename(_path, backup.c_str());
+    Serial.printf("Unusable sample store moved to %s\n", backup.c_str());
+    return create();
+  }
+
+  _head = header.head;
+  _count = header.count;
+  _epochFloor = header.epochFloor;
+  _pending = 0;
+  loadPage(_head - _head % RECORDS_PER_PAGE);
+  return recover();
+}
+
+bool SampleStore::isValid(const Sample &sample) const {
+  return sample.epoch != 0 && sample.epoch >= _epochFloor && sample.check == checksum(sample);
+}
+
+bool SampleStore::recover() {
+  uint32_t oldHead = _head;
+  uint32_t oldCount = _count;
+
+  // Cut off a torn tail: drop every record from the first bad one in the page up to the cursor.
+  for (uint32_t slot = _pageFirst; slot < _head && _head - slot <= _count; slot++) {
+    if (!isValid(_page[slot - _pageFirst])) {
+      _count -= _head - slot;
+      _head = slot;
+      break;
+    }
+  }
+
+  // Take back records that reached the file after the last cursor update. In a
+  // full ring the slots past the cursor hold older records, which stop the scan.
+  // The newest record is in the previous sector when the cursor starts a new one.
+  uint32_t lastEpoch = _epochFloor;
+  if (_count > 0) {
+    Sample last;
+    if (!readSlot((_head + _capacity - 1) % _capacity, &last, 1)) {
+      last.epoch = UINT32_MAX;  // Without it nothing can be told apart as newer
+    }
+    lastEpoch = max(lastEpoch, last.epoch);
+  }
+  uint32_t pageEnd = min(_pageFirst + RECORDS_PER_PAGE, _capacity);
+  while (_head < pageEnd) {
+    const Sample &sample = _page[_head - _pageFirst];
+    if (!isValid(sample) || sample.epoch < lastEpoch) {
+      break;
+    }
+    lastEpoch = sample.epoch;
+    _head++;
+    _count = min(_count + 1, _capacity);
+  }
+
+  // In a full ring a write torn past the cursor has damaged the oldest records,
+  // drop those. The ring is sorted, so one newer than its successor is damaged too.
+  for (uint32_t slot = _head; slot < pageEnd && _count > 0 && slotOf(0) == slot; slot++) {
+    const Sample &sample = _page[slot - _pageFirst];
+    bool ordered = slot + 1 >= pageEnd || !isValid(_page[slot + 1 - _pageFirst])
+        || sample.epoch <= _page[slot + 1 - _pageFirst].epoch;
+    if (isValid(sample) && ordered) {
+      break;
+    }
+    _count--;
+  }
+
+  if (_head == pageEnd) {
+    _head %= _capacity;
+    loadPage(_head);
+  }
+
+  // A newest record that cannot be read leaves only the floor to go by.
+  _newestEpoch = _epochFloor;
+  Sample newest;
+  if (_count > 0 && readSlot((_head + _capacity - 1) % _capacity, &newest, 1)) {
+    _newestEpoch = max(_newestEpoch, newest.epoch);
+  }
+
+  if (_head == oldHead && _count == oldCount) {
+    return true;
+  }
+  Serial.printf("Sample store cursor recovered from %u to %u\n", oldHead, _head);
+  return writeHeader();
+}
+
+bool SampleStore::create() {
+  _file = _fs.open(_path, "w+");
+  if (!_file) {
+    return false;
+  }
+  _head = 0;
+  _count = 0;
+  _epochFloor = 0;
+  _newestEpoch = 0;
+  _pending = 0;
+  loadPage(0);
+  return writeHeader();
+}
+
+bool SampleStore::writeHeader() {
+  // The header is written as a whole zero-padded sector.
+  uint8_t sector[HEADER_SIZE] = {0};
+  Header header = {MAGIC, VERSION, sizeof(Sample), _capacity, _head, _count, _epochFloor};
+  memcpy(sector, &header, sizeof(header));
+  if (!_file.seek(0) || _file.write(sector, sizeof(sector)) != sizeof(sector)) {
+    return false;
+  }
+  _file.flush();
+  return true;
+}
+
+bool SampleStore::loadPage(uint32_t first) {
+  // The sector may still hold the oldest records of a full ring, keep them.
+  memset(_page, 0, sizeof(_page));
+  _pageFirst = first;
+  size_t len = min(RECORDS_PER_PAGE, _capacity - first) * sizeof(Sample);
+  if (_file.seek(HEADER_SIZE + first * sizeof(Sample))) {
+    _file.read((uint8_t *)_page, len);
+  }
+  return true;
+}
+
+bool SampleStore::writePage() {
+  size_t len = min(RECORDS_PER_PAGE, _capacity - _pageFirst) * sizeof(Sample);
+  return _file.seek(HEADER_SIZE + _pageFirst * sizeof(Sample))
+      && _file.write((const uint8_t *)_page, len) == len;
+}
+
+bool SampleStore::flushLocked() {
+  if (_pending == 0) {
+    return true;
+  }
+  if (!writePage() || !writeHeader()) {
+    return false;
+  }
+  _pending = 0;
+  return true;
+}
+
+bool SampleStore::flush() {
+  StoreLock guard(_lock);
+  if (!_file) {
+    return false;
+  }
+  return flushLocked();
+}
+
+bool SampleStore::flushIfDue() {
+  StoreLock guard(_lock);
+  if (!_file || _pending == 0 || _flushAgeMs == 0 || millis() - _pendingSince < _flushAgeMs) {
+    return true;
+  }
+  return flushLocked();
+}
+
+void SampleStore::setFlushPolicy(uint32_t maxRecords, unsigned long maxAgeMs) {
+  StoreLock guard(_lock);
+  _flushRecords = constrain(maxRecords, (uint32_t)1, RECORDS_PER_PAGE);
+  _flushAgeMs = maxAgeMs;
+}
+
+bool SampleStore::append(const Sample &sample) {
+  StoreLock guard(_lock);
+  if (!_file || sample.epoch < _epochFloor || sample.epoch < _newestEpoch) {
+    return false;
+  }
+  _newestEpoch = sample.epoch;
+
+  Sample &record = _page[_head - _pageFirst];
+  record = sample;
+  record.check = checksum(record);
+  if (_pending++ == 0) {
+    _pendingSince = millis();
+  }
+
+  _head = (_head + 1) % _capacity;
+  if (_count < _capacity) {
+    _count++;
+  }
+
+  if (_head == 0 || _head >= _pageFirst + RECORDS_PER_PAGE) {
+    // The page is complete, write it out and move on to the next sector.
+    bool ok = flushLocked();
+    loadPage(_head);
+    return ok;
+  }
+  if (_pending >= _flushRecords) {
+    return flushLocked();
+  }
+  return true;
+}
+
+uint32_t SampleStore::slotOf(uint32_t index) const {
+  return (_head + _capacity - _count + index) % _capacity;
+}
+
+bool SampleStore::readSlot(uint32_t slot, Sample *out, size_t count) {
+  // Slots in the buffered page come from RAM, the file may not have them yet.
+  while (count > 0) {
+    size_t run = count;
+    if (slot >= _pageFirst && slot < _pageFirst + RECORDS_PER_PAGE) {
+      run = min(run, (size_t)(_pageFirst + RECORDS_PER_PAGE - slot));
+      memcpy(out, &_page[slot - _pageFirst], run * sizeof(Sample));
+    } else {
+      if (slot < _pageFirst) {
+        run = min(run, (size_t)(_pageFirst - slot));
+      }
+      size_t len = run * sizeof(Sample);
+      if (!_file.seek(HEADER_SIZE + slot * sizeof(Sample)) || _file.read((uint8_t *)out, len) != len) {
+        return false;
+      }
+    }
+    slot += run;
+    out += run;
+    count -= run;
+  }
+  return true;
+}
+
+size_t SampleStore::read(uint32_t index, Sample *out, size_t count) {
+  StoreLock guard(_lock);
+  if (!_file || index >= _count) {
+    return 0;
+  }
+  if (count > _count - index) {
+    count = _count - index;
+  }
+
+  // A range can wrap past the end of the file, read it in at most two runs.
+  size_t done = 0;
+  while (done < count) {
+    uint32_t slot = slotOf(index + done);
+    size_t run = min((size_t)(_capacity - slot), count - done);
+    if (!readSlot(slot, out + done, run)) {
+      break;
+    }
+    done += run;
+  }
+  return done;
+}
+
+uint32_t SampleStore::seek(uint32_t epoch) {
+  StoreLock guard(_lock);
+  if (!_file) {
+    return 0;
+  }
+
+  // Samples are appended in time order, so the ring is sorted by epoch.
+  uint32_t lo = 0;
+  uint32_t hi = _count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    Sample sample;
+    if (!readSlot(slotOf(mid), &sample, 1)) {
+      return _count;
+    }
+    if (sample.epoch < epoch) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool SampleStore::clear() {
+  StoreLock guard(_lock);
+  if (!_file) {
+    return false;
+  }
+
+  // The records stay in the file, raising the floor past the newest one keeps
+  // recover() from taking them back.
+  if (_count > 0) {
+    Sample last;
+    if (!readSlot((_head + _capacity - 1) % _capacity, &last, 1)) {
+      return false;
+    }
+    _epochFloor = max(_epochFloor, last.epoch + 1);
+  }
+  _head = 0;
+  _count = 0;
+  _newestEpoch = _epochFloor;
+  _pending = 0;
+  memset(_page, 0, sizeof(_page));
+  _pageFirst = 0;
+  return writeHeader();
+}
+
+int16_t SampleStore::toCentiC(float tempC) {
+  return (int16_t)lroundf(tempC * 100.0f);
+}
+
+float SampleStore::fromCentiC(int16_t centiC) {
+  return centiC / 100.0f;
+}
+
+uint8_t SampleStore::checksum(const Sample &sample) {
+  // CRC-8, polynomial 0x31, starting from 0xFF so an all-zero record never passes.
+  const uint8_t *data = (const uint8_t *)&sample;
+  uint8_t crc = 0xFF;
+  for (size_t i = 0; i < offsetof(Sample, check); i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file TemperatureSensor.cpp
+ * @brief Non-blocking acquisition from every DS18B20 on the OneWire bus.
+ */
+
+#include "TemperatureSensor.h"
+
+TemperatureSensor::TemperatureSensor(DallasTemperature &sensors, fs::FS &fs, const char *path)
+  : _sensors(sensors), _fs(fs), _path(path) {
+}
+
+void TemperatureSensor::begin() {
+  load();
+  scan();
+  _sensors.setWaitForConversion(false);
+}
+
+int TemperatureSensor::findSlot(const DeviceAddress address) const {
+  for (uint8_t i = 0; i < _slotCount; i++) {
+    if (memcmp(_slots[i].address, address, sizeof(DeviceAddress)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+uint8_t TemperatureSensor::scan() {
+  _sensors.begin();
+  _conversionTime = _sensors.millisToWaitForConversion(_sensors.getResolution());
+
+  for (uint8_t i = 0; i < _slotCount; i++) {
+    _slots[i].present = false;
+  }
+
+  uint8_t devices = _sensors.getDeviceCount();
+  for (uint8_t i = 0; i < devices; i++) {
+    DeviceAddress address;
+    if (!_sensors.getAddress(address, i) || !_sensors.validFamily(address)) {
+      continue;
+    }
+
+    int slot = findSlot(address);
+    if (slot < 0) {
+      if (_slotCount == MAX_TEMPERATURE_SENSORS) {
+        // Another probe's ID would mix its history with this one's.
+        Serial.printf("Sensor registry full, probe %02x%02x%02x%02x%02x%02x%02x%02x ignored\n",
+                      address[0], address[1], address[2], address[3],
+                      address[4], address[5], address[6], address[7]);
+        continue;
+      }
+      slot = _slotCount++;
+      memcpy(_slots[slot].address, address, sizeof(DeviceAddress));
+      _slots[slot].valid = false;
+      _slots[slot].tempC = DEVICE_DISCONNECTED_C;
+      if (!save()) {
+        Serial.println("Failed to save the sensor registry");
+      }
+    }
+    _slots[slot].present = true;
+  }
+
+  _sinceScan = 0;
+  _rescan = false;
+  return present();
+}
+
+void TemperatureSensor::load() {
+  _slotCount = 0;
+  File file = _fs.open(_path, "r");
+  if (!file) {
+    return;
+  }
+  // The file holds the address of each ID in turn.
+  while (_slotCount < MAX_TEMPERATURE_SENSORS
+         && file.read(_slots[_slotCount].address, sizeof(DeviceAddress)) == sizeof(DeviceAddress)) {
+    Slot &slot = _slots[_slotCount++];
+    slot.present = false;
+    slot.valid = false;
+    slot.tempC = DEVICE_DISCONNECTED_C;
+  }
+  file.close();
+}
+
+bool TemperatureSensor::save() {
+  File file = _fs.open(_path, "w");
+  if (!file) {
+    return false;
+  }
+  bool ok = true;
+  for (uint8_t i = 0; i < _slotCount; i++) {
+    ok &= file.write(_slots[i].address, sizeof(DeviceAddress)) == sizeof(DeviceAddress);
+  }
+  file.close();
+  return ok;
+}
+
+uint8_t TemperatureSensor::present() const {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < _slotCount; i++) {
+    if (_slots[i].present) {
+      n++;
+    }
+  }
+  return n;
+}
+
+void TemperatureSensor::start() {
+  if (_state == CONVERTING) {
+    return;
+  }
+  if (_rescan || _sinceScan >= RESCAN_PERIOD || present() == 0) {
+    scan();
+  }
+  _sinceScan++;
+
+  // One broadcast converts every probe on the bus at once.
+  _sensors.requestTemperatures();
+  _startedAt = millis();
+  _state = CONVERTING;
+}
+
+bool TemperatureSensor::poll() {
+  if (_state != CONVERTING || millis() - _startedAt < _conversionTime) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < _slotCount; i++) {
+    Slot &slot = _slots[i];
+    if (!slot.present) {
+      slot.valid = false;
+      continue;
+    }
+    slot.tempC = _sensors.getTempC(slot.address);
+    slot.valid = slot.tempC != DEVICE_DISCONNECTED_C;
+    if (!slot.valid) {
+      _rescan = true;
+    }
+  }
+  _state = IDLE;
+  return true;
+}
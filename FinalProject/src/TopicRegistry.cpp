@@ -0,0 +1,142 @@
+/**
+ * @file TopicRegistry.cpp
+ * @brief Per-topic lists of the WebSocket clients subscribed to it.
+ */
+
+#include "TopicRegistry.h"
+
+namespace {
+  // Subscriptions change on the async_tcp task while the publish task walks them.
+  class RegistryLock {
+    public:
+      explicit RegistryLock(SemaphoreHandle_t lock) : _lock(lock) { xSemaphoreTake(_lock, portMAX_DELAY); }
+      ~RegistryLock() { xSemaphoreGive(_lock); }
+    private:
+      SemaphoreHandle_t _lock;
+  };
+}
+
+TopicRegistry::TopicRegistry() {
+  _lock = xSemaphoreCreateMutex();
+}
+
+int TopicRegistry::add(const char *name) {
+  int existing = find(name);
+  if (existing >= 0) {
+    return existing;
+  }
+  if (_topicCount == MAX_TOPICS || strlen(name) >= TOPIC_NAME_MAX) {
+    return -1;
+  }
+
+  RegistryLock guard(_lock);
+  Topic &topic = _topics[_topicCount];
+  strlcpy(topic.name, name, sizeof(topic.name));
+  topic.count = 0;
+  return _topicCount++;
+}
+
+int TopicRegistry::find(const char *name) const {
+  // Topics are only ever added, so the names can be read without the lock
+  for (uint8_t i = 0; i < _topicCount; i++) {
+    if (strcmp(_topics[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool TopicRegistry::subscribe(AsyncWebSocketClient *client, int topic, uint32_t minIntervalMs) {
+  if (topic < 0 || topic >= _topicCount) {
+    return false;
+  }
+
+  RegistryLock guard(_lock);
+  Topic &entry = _topics[topic];
+  int index = indexOf(entry, client);
+  if (index < 0) {
+    if (entry.count == MAX_TOPIC_SUBSCRIBERS) {
+      return false;
+    }
+    index = entry.count++;
+    entry.subscribers[index].client = client;
+    entry.subscribers[index].clientId = client->id();
+    entry.subscribers[index].sent = false;
+  }
+  entry.subscribers[index].minIntervalMs = minIntervalMs;
+  return true;
+}
+
+bool TopicRegistry::unsubscribe(AsyncWebSocketClient *client, int topic) {
+  if (topic < 0 || topic >= _topicCount) {
+    return false;
+  }
+
+  RegistryLock guard(_lock);
+  int index = indexOf(_topics[topic], client);
+  if (index < 0) {
+    return false;
+  }
+  erase(_topics[topic], index);
+  return true;
+}
+
+void TopicRegistry::remove(AsyncWebSocketClient *client) {
+  RegistryLock guard(_lock);
+  for (uint8_t i = 0; i < _topicCount; i++) {
+    int index = indexOf(_topics[i], client);
+    if (index >= 0) {
+      erase(_topics[i], index);
+    }
+  }
+}
+
+size_t TopicRegistry::subscribers(int topic) const {
+  if (topic < 0 || topic >= _topicCount) {
+    return 0;
+  }
+  return _topics[topic].count;
+}
+
+size_t TopicRegistry::publish(int topic, uint32_t now, const Sender &send) {
+  if (topic < 0 || topic >= _topicCount || _topics[topic].count == 0) {
+    return 0;
+  }
+
+  // Sending takes the server and client locks, which the async_tcp task holds
+  // when it changes subscriptions, so only the IDs are taken under this one
+  uint32_t due[MAX_TOPIC_SUBSCRIBERS];
+  size_t dueCount = 0;
+  {
+    RegistryLock guard(_lock);
+    Topic &entry = _topics[topic];
+    for (uint8_t i = 0; i < entry.count; i++) {
+      Subscriber &subscriber = entry.subscribers[i];
+      if (subscriber.sent && now - subscriber.lastSent < subscriber.minIntervalMs) {
+        continue;
+      }
+      due[dueCount++] = subscriber.clientId;
+      subscriber.lastSent = now;
+      subscriber.sent = true;
+    }
+  }
+
+  for (size_t i = 0; i < dueCount; i++) {
+    send(due[i]);
+  }
+  return dueCount;
+}
+
+int TopicRegistry::indexOf(const Topic &topic, AsyncWebSocketClient *client) const {
+  for (uint8_t i = 0; i < topic.count; i++) {
+    if (topic.subscribers[i].client == client) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void TopicRegistry::erase(Topic &topic, int index) {
+  // Order does not matter, move the last subscriber into the gap
+  topic.subscribers[index] = topic.subscribers[--topic.count];
+}
@@ -16,26 +16,50 @@
 #include <NTPClient.h>
 #include <ESPmDNS.h>
 #include <Arduino_Json.h>
+#include <memory>
+#include <atomic>
+#include <esp_system.h>
+#include "SampleStore.h"
+#include "Downsampler.h"
+#include "SampleExport.h"
+#include "TemperatureSensor.h"
+#include "SampleQueue.h"
+#include "ClockService.h"
+#include "TopicRegistry.h"
 
 //AsyncWebServer port
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 
 //Function Prototypes
-String readDSTemperatureC();
+void readDSTemperatureC(char *buf, size_t len);
 String processor(const String& var);
-bool getTimeStamp();
-void saveData();
+void saveData(const Sample &sample);
+void startTasks();
+void acquisitionTask(void *param);
+void handOverSample(const Sample &sample);
+void holdUnsyncedSample(const Sample &sample);
+void releaseUnsyncedSamples();
+void storageTask(void *param);
+void flushOnShutdown();
+void publishTask(void *param);
 void initSDCard();
 void clearWifiConfig();
 bool initWiFi();
 void writeFile(fs::FS &fs, const char * path, const char * message);
 String readFile(fs::FS &fs, const char * path);
 void initLittleFS();
-void notifyClients(String csvData);
-void handleWebSocketMessage(void *arg, uint8_t *data, size_t len);
+void publishSamples(const Sample *samples, size_t count);
+void publishSamplesToTopic(int topic, const Sample *samples, size_t count, uint32_t now);
+void publishAlarms(uint32_t previous, uint32_t current);
+AsyncWebSocketMessageBuffer *makeSampleRows(const Sample *samples, size_t count);
+void handleWebSocketMessage(AsyncWebSocketClient *client, void *arg, uint8_t *data, size_t len);
+bool applySubscription(AsyncWebSocketClient *client, JSONVar topics, bool subscribe, uint32_t minIntervalMs);
 void onEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
 void initWebSocket();
+void sendExport(AsyncWebServerRequest *request);
+void sendDownsampledCsv(AsyncWebServerRequest *request);
+uint32_t getUIntParam(AsyncWebServerRequest *request, const char *name, uint32_t fallback);
 
 //Temp here --------------------------------------------------
 //Temp data wire define
@@ -44,11 +68,61 @@ void initWebSocket();
 //One wire instance
 OneWire oneWire(ONE_WIRE_BUS);
 DallasTemperature sensors(&oneWire);
-String temperatureC = "";
+TemperatureSensor temperatureSensor(sensors, LittleFS, "/sensors.bin");
+char temperatureC[CENTIC_MAX] = "--";
 
-unsigned long lastTime = 0;  
 unsigned long timerDelay = 30000;
 //---------------------------------------------------------
+//Sample storage----------------------------------------------
+//31 days of samples at one per timerDelay
+#define SAMPLE_STORE_CAPACITY 89280UL
+//Buffered samples are written once this many are pending or the oldest is this old
+#define SAMPLE_FLUSH_RECORDS SampleStore::RECORDS_PER_PAGE
+#define SAMPLE_FLUSH_AGE_MS 300000UL
+//Points returned by /getdata when the request does not say
+#define DEFAULT_CHART_POINTS 300
+#define MAX_CHART_POINTS 1000
+static_assert(MAX_TEMPERATURE_SENSORS <= DownsampledExporter::MAX_SENSORS, "/getdata keeps one Downsampler per sensor");
+
+SampleStore sampleStore(SD, "/data.bin", SAMPLE_STORE_CAPACITY);
+//------------------------------------------------------------
+//Tasks-------------------------------------------------------
+//The acquisition task hands samples to the storage and publish tasks
+#define SAMPLE_QUEUE_SIZE 64
+#define TASK_STACK_SIZE 4096
+#define ACQUISITION_TASK_PRIORITY 3
+#define STORAGE_TASK_PRIORITY 1
+#define PUBLISH_TASK_PRIORITY 1
+#define ACQUISITION_TASK_CORE 1
+#define IO_TASK_CORE 0
+
+SampleQueue<Sample, SAMPLE_QUEUE_SIZE> storageQueue;
+SampleQueue<Sample, SAMPLE_QUEUE_SIZE> publishQueue;
+TaskHandle_t storageTaskHandle = NULL;
+TaskHandle_t publishTaskHandle = NULL;
+//Probes with a valid reading in the last acquisition cycle, bit N for sensor ID N
+std::atomic<uint32_t> validSensors(0);
+//Until the first NTP sync the clock counts from boot, which would break the time
+//order of the store. The latest samples wait here, stamped with millis(), and are
+//handed over once the wall-clock time is known. Leaves room in the sample queues.
+#define UNSYNCED_SAMPLE_BACKLOG (SAMPLE_QUEUE_SIZE / 2)
+struct UnsyncedSample {
+  Sample sample;
+  unsigned long takenAt;
+};
+UnsyncedSample unsyncedSamples[UNSYNCED_SAMPLE_BACKLOG];
+size_t unsyncedFirst = 0;
+size_t unsyncedCount = 0;
+//------------------------------------------------------------
+//WebSocket topics--------------------------------------------
+//Clients subscribe with {"subscribe":["sensor/1","alarms"],"interval":5000}
+//and leave with {"unsubscribe":"samples"}
+#define WS_REQUEST_MAX 256                   //Longest request, copied to the stack to terminate it
+TopicRegistry topics;
+int samplesTopic = -1;                       //Every sample, new clients start out subscribed
+int alarmsTopic = -1;                        //Probes dropping out and coming back
+int sensorTopics[MAX_TEMPERATURE_SENSORS];   //sensor/<id>, the samples of one probe
+//------------------------------------------------------------
 //Wifi Config-------------------------------------------------
 //Search parameter in HTTP post request
 const char* PARAM_INPUT_1 = "ssid";
@@ -81,10 +155,11 @@ const long interval = 10000;
 
 //datetime-------------------------------------------------
 WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "87.104.58.9", 3600, 60000);
-String formattedDate;
-String dayStamp;
-String timeStamp;
+//Asked together, the answer with the shortest round trip wins and failing servers back off
+const char* ntpServers[] = {"87.104.58.9", "0.pool.ntp.org", "1.pool.ntp.org"};
+NTPClient timeClient(ntpUDP, ntpServers, sizeof(ntpServers) / sizeof(ntpServers[0]), 3600, 60000);
+//Sync every minute at first, stretching to hourly while the clock holds
+ClockService clockService(timeClient, 60000, 3600000);
 //------------------------------------------------------------
 
 /**
@@ -93,6 +168,7 @@ String timeStamp;
 void setup(){
     Serial.begin(115200);
     initLittleFS();
+    temperatureSensor.begin();
     initSDCard();
     ssid = readFile(LittleFS, ssidPath);
     pass = readFile(LittleFS, passPath);
@@ -132,22 +208,15 @@ void setup(){
         });
 
         server.on("/download", HTTP_GET, [](AsyncWebServerRequest *request){
-            request->send(SD, "/data.csv", "text/csv", true);
+            sendExport(request);
         });
 
         server.on("/getdata", HTTP_GET, [](AsyncWebServerRequest *request){
-          File file = SD.open("/data.csv", FILE_READ);
-          if (file){
-            String data = file.readString();
-            request->send(200, "text/csv", data);
-          }
-          else{
-            request->send(404, "text/plain", "File not found");
-          }
+            sendDownsampledCsv(request);
         });
 
         server.on("/delete", HTTP_GET, [](AsyncWebServerRequest *request){
-          SD.remove("/data.csv");
+          sampleStore.clear();
           request->send(200, "text/plain", "File deleted");
         });
     server.begin();
@@ -204,18 +273,16 @@ void setup(){
     server.begin();
   }
 
+    startTasks();
 }
 
 /**
  * @brief Main loop function for periodic tasks.
  */
 void loop(){
-    if((millis() - lastTime) > timerDelay){
-        temperatureC = readDSTemperatureC();
-        lastTime = millis();
-        saveData();
+    if(WiFi.status() == WL_CONNECTED){
+        clockService.update();
     }
-    getTimeStamp();
     ws.cleanupClients();
 }
 
@@ -325,22 +392,34 @@ void clearWifiConfig(){
 }
 
 /**
- * @brief Read temperature from DS18B20 sensor in Celsius.
+ * @brief Format the last DS18B20 reading in Celsius.
+ *
+ * The readings themselves are taken by temperatureSensor, this never touches the bus.
+ * Called from the acquisition task, so it must not use the loop() time stamps.
  * 
- * @return Temperature value as a String.
+ * @param buf Receives the temperature of the first probe that answered, or `--`.
+ * @param len Size of buf, at least CENTIC_MAX.
  */
-String readDSTemperatureC() {
-  sensors.requestTemperatures(); 
-  float tempC = sensors.getTempCByIndex(0);
-
-  if(tempC == -127.00) {
-    Serial.println("Failed to read from DS18B20 sensor");
-    return "--";
-  } else {
-    Serial.print("Temperature Celsius " + dayStamp +":"+ timeStamp + " : ");
-    Serial.println(tempC); 
+void readDSTemperatureC(char *buf, size_t len) {
+  bool found = false;
+  for (uint8_t id = 0; id < temperatureSensor.count(); id++) {
+    if (!temperatureSensor.present(id)) {
+      continue;
+    }
+    if(!temperatureSensor.valid(id)) {
+      Serial.printf("Failed to read from DS18B20 sensor %u\n", id);
+      continue;
+    }
+    float tempC = temperatureSensor.tempC(id);
+    Serial.printf("Temperature Celsius sensor %u : ", id);
+    Serial.println(tempC);
+    if (!found) {
+      found = formatCentiC(SampleStore::toCentiC(tempC), buf, len) > 0;
+    }
+  }
+  if (!found) {
+    strlcpy(buf, "--", len);
   }
-  return String(tempC);
 }
 
 /**
@@ -351,97 +430,493 @@ String readDSTemperatureC() {
  */
 String processor(const String& var){
   if(var == "TEMPERATUREC"){
-    return temperatureC;
+    return String(temperatureC);
   }
   return String();
 }
 
 /**
- * @brief Get current date and time stamp.
- * 
- * @return True if timestamp is obtained successfully, otherwise false.
+ * @brief Initialize the SD card.
  */
-bool getTimeStamp() {
-  if (!timeClient.update()) {
-    timeClient.forceUpdate();
-    delay(500);
+void initSDCard(){
+  if(!SD.begin()){
+    Serial.println("Card mount Failed");
+    return;
   }
-
-  if (!timeClient.update()) {
-    return false;
+  if(!sampleStore.begin()){
+    Serial.println("Error opening data.bin file");
+    return;
   }
+  sampleStore.setFlushPolicy(SAMPLE_FLUSH_RECORDS, SAMPLE_FLUSH_AGE_MS);
+  esp_register_shutdown_handler(flushOnShutdown);
+  Serial.printf("Sample store holds %u samples\n", sampleStore.size());
+}
 
-  formattedDate = timeClient.getFormattedDate();
-  int splitT = formattedDate.indexOf("T");
-  if (splitT == -1) {
-    return false;
+/**
+ * @brief Write buffered samples before the ESP restarts.
+ */
+void flushOnShutdown(){
+  sampleStore.flush();
+}
+
+/**
+ * @brief Start the acquisition, storage and publish tasks.
+ */
+void startTasks() {
+  xTaskCreatePinnedToCore(storageTask, "storage", TASK_STACK_SIZE, NULL, STORAGE_TASK_PRIORITY, &storageTaskHandle, IO_TASK_CORE);
+  xTaskCreatePinnedToCore(publishTask, "publish", TASK_STACK_SIZE, NULL, PUBLISH_TASK_PRIORITY, &publishTaskHandle, IO_TASK_CORE);
+  xTaskCreatePinnedToCore(acquisitionTask, "acquisition", TASK_STACK_SIZE, NULL, ACQUISITION_TASK_PRIORITY, NULL, ACQUISITION_TASK_CORE);
+}
+
+/**
+ * @brief Take one reading from every probe per timerDelay.
+ *
+ * Runs on a fixed period of its own, so a slow SD card or NTP request cannot
+ * delay a sample. Samples are handed to the other tasks through lock-free queues,
+ * once the clock has been synced from NTP.
+ *
+ * @param param Unused.
+ */
+void acquisitionTask(void *param) {
+  TickType_t lastWake = xTaskGetTickCount();
+  for (;;) {
+    temperatureSensor.start();
+    while (!temperatureSensor.poll()) {
+      vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    readDSTemperatureC(temperatureC, sizeof(temperatureC));
+
+    bool synced = clockService.synced();
+    if (synced) {
+      releaseUnsyncedSamples();
+    }
+    uint32_t epoch = clockService.now();
+    uint32_t valid = 0;
+    for (uint8_t id = 0; id < temperatureSensor.count(); id++) {
+      if (!temperatureSensor.valid(id)) {
+        continue;
+      }
+      valid |= 1UL << id;
+
+      Sample sample = {};
+      sample.epoch = epoch;
+      sample.centiC = SampleStore::toCentiC(temperatureSensor.tempC(id));
+      sample.sensor = id;
+      if (synced) {
+        handOverSample(sample);
+      } else {
+        holdUnsyncedSample(sample);
+      }
+    }
+    validSensors.store(valid);
+    xTaskNotifyGive(storageTaskHandle);
+    xTaskNotifyGive(publishTaskHandle);
+
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(timerDelay));
   }
+}
 
-  dayStamp = formattedDate.substring(0, splitT);
-  timeStamp = formattedDate.substring(splitT + 1, formattedDate.length() - 1);
+/**
+ * @brief Queue a sample for the storage and publish tasks.
+ */
+void handOverSample(const Sample &sample) {
+  if (!storageQueue.push(sample)) {
+    Serial.println("Storage queue full, sample dropped");
+  }
+  publishQueue.push(sample);
+}
 
-  return true;
+/**
+ * @brief Keep a sample taken before the first NTP sync, dropping the oldest one if the backlog is full.
+ */
+void holdUnsyncedSample(const Sample &sample) {
+  if (unsyncedCount == UNSYNCED_SAMPLE_BACKLOG) {
+    unsyncedFirst = (unsyncedFirst + 1) % UNSYNCED_SAMPLE_BACKLOG;
+    unsyncedCount--;
+  }
+  UnsyncedSample &held = unsyncedSamples[(unsyncedFirst + unsyncedCount) % UNSYNCED_SAMPLE_BACKLOG];
+  held.sample = sample;
+  held.takenAt = millis();
+  unsyncedCount++;
 }
 
 /**
- * @brief Initialize the SD card.
+ * @brief Stamp the samples held before the first NTP sync with wall-clock time and hand them over.
  */
-void initSDCard(){
-  if(!SD.begin()){
-    Serial.println("Card mount Failed");
+void releaseUnsyncedSamples() {
+  if (unsyncedCount == 0) {
     return;
   }
-  File dataFile = SD.open("/data.csv", FILE_WRITE);
-  dataFile.println("Time,Temperature");
+  uint64_t nowMs = clockService.nowMs();
+  unsigned long now = millis();
+  for (; unsyncedCount > 0; unsyncedCount--) {
+    UnsyncedSample &held = unsyncedSamples[unsyncedFirst];
+    held.sample.epoch = (nowMs - (now - held.takenAt)) / 1000;
+    handOverSample(held.sample);
+    unsyncedFirst = (unsyncedFirst + 1) % UNSYNCED_SAMPLE_BACKLOG;
+  }
+  Serial.println("Clock synced, samples taken before it handed over");
+}
 
-  if(!dataFile){
-    Serial.println("Error opening data.CSV file");
-    return;
+/**
+ * @brief Write queued samples to the SD card.
+ *
+ * Wakes up at least once a second so buffered samples get flushed on age
+ * even when no new ones arrive.
+ *
+ * @param param Unused.
+ */
+void storageTask(void *param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+    Sample sample;
+    while (storageQueue.pop(sample)) {
+      saveData(sample);
+    }
+    if (!sampleStore.flushIfDue()) {
+      Serial.println("Error flushing data.bin file");
+    }
   }
-  dataFile.close();
 }
 
 /**
- * @brief Save temperature data to the SD card.
+ * @brief Push queued samples and probe alarms to the WebSocket clients.
+ *
+ * @param param Unused.
  */
-void saveData(){
-  File dataFile = SD.open("/data.csv", FILE_APPEND);
+void publishTask(void *param) {
+  Sample batch[SAMPLE_FRAME_MAX_SAMPLES];
+  uint32_t lastValid = 0;
+  bool firstCycle = true;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint32_t valid = validSensors.load();
+    if (!firstCycle && valid != lastValid) {
+      publishAlarms(lastValid, valid);
+    }
+    lastValid = valid;
+    firstCycle = false;
+
+    size_t count = 0;
+    while (publishQueue.pop(batch[count])) {
+      if (++count == SAMPLE_FRAME_MAX_SAMPLES) {
+        publishSamples(batch, count);
+        count = 0;
+      }
+    }
+    if (count > 0) {
+      publishSamples(batch, count);
+    }
+  }
+}
 
- if(!dataFile){
-    Serial.println("Error opening data.CSV file");
-    return;
- }
- 
-  if (dataFile.available()) {
-    dataFile.seek(0);
-  }
-  String data = dayStamp + " " + timeStamp + "," + readDSTemperatureC();
-  dataFile.print(dayStamp + " " + timeStamp);
-  dataFile.print(",");
-  dataFile.println(readDSTemperatureC());
-  notifyClients(data);
-  dataFile.close();
+/**
+ * @brief Save a temperature sample to the SD card.
+ *
+ * @param sample Sample to save.
+ */
+void saveData(const Sample &sample){
+  if (!sampleStore.append(sample)) {
+    Serial.println("Error writing data.bin file");
+  }
 }
 
 /**
- * @brief Notify all WebSocket clients with temperature data.
- * 
- * @param csvData Temperature data in CSV format.
+ * @brief Read an unsigned integer query parameter.
+ *
+ * @param request Request holding the parameter.
+ * @param name Name of the parameter.
+ * @param fallback Value returned when the parameter is missing.
+ * @return Value of the parameter.
  */
-void notifyClients(String csvData) {
-  ws.textAll(csvData);
+uint32_t getUIntParam(AsyncWebServerRequest *request, const char *name, uint32_t fallback) {
+  if (!request->hasParam(name)) {
+    return fallback;
+  }
+  return strtoul(request->getParam(name)->value().c_str(), NULL, 10);
 }
 
 /**
- * @brief Handle WebSocket message.
- * 
+ * @brief Stream the samples between `from` and `to` as a CSV or NDJSON attachment.
+ *
+ * The body is produced a chunk at a time while the client acknowledges it, so
+ * memory use does not depend on the size of the export.
+ *
+ * @param request Request to answer.
+ */
+void sendExport(AsyncWebServerRequest *request) {
+  uint32_t from = getUIntParam(request, "from", 0);
+  uint32_t to = getUIntParam(request, "to", UINT32_MAX);
+  bool ndjson = request->hasParam("format") && request->getParam("format")->value() == "ndjson";
+
+  auto exporter = std::make_shared<SampleExporter>(sampleStore, ndjson ? ExportFormat::NDJSON : ExportFormat::CSV, from, to);
+  AsyncWebServerResponse *response = request->beginChunkedResponse(ndjson ? "application/x-ndjson" : "text/csv",
+    [exporter](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return exporter->fill(buffer, maxLen);
+    });
+  response->addHeader("Content-Disposition", ndjson ? "attachment; filename=\"data.ndjson\"" : "attachment; filename=\"data.csv\"");
+  request->send(response);
+}
+
+/**
+ * @brief Send the samples between `from` and `to` reduced to at most `points` rows per sensor.
+ *
+ * Each row holds the mean time, the sensor ID and the mean temperature of a
+ * bucket, followed by the lowest and highest temperature in it. An optional
+ * `sensor` parameter limits the answer to one probe.
+ *
+ * @param request Request to answer.
+ */
+void sendDownsampledCsv(AsyncWebServerRequest *request) {
+  uint32_t from = getUIntParam(request, "from", 0);
+  uint32_t to = getUIntParam(request, "to", UINT32_MAX);
+  uint32_t points = getUIntParam(request, "points", DEFAULT_CHART_POINTS);
+  points = constrain(points, 1, MAX_CHART_POINTS);
+  uint32_t sensor = getUIntParam(request, "sensor", UINT32_MAX);
+
+  auto exporter = std::make_shared<DownsampledExporter>(sampleStore, from, to, points, sensor, temperatureSensor.count());
+  AsyncWebServerResponse *response = request->beginChunkedResponse("text/csv",
+    [exporter](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return exporter->fill(buffer, maxLen);
+    });
+  request->send(response);
+}
+
+/**
+ * @brief Send a batch of samples to the clients subscribed to it.
+ *
+ * The batch goes to the `samples` topic as a whole and to each `sensor/<id>`
+ * topic that has subscribers as the part of it taken by that probe.
+ *
+ * @param samples Samples to send, in time order.
+ * @param count Number of samples, at most SAMPLE_FRAME_MAX_SAMPLES.
+ */
+void publishSamples(const Sample *samples, size_t count) {
+  uint32_t now = millis();
+  publishSamplesToTopic(samplesTopic, samples, count, now);
+
+  Sample subset[SAMPLE_FRAME_MAX_SAMPLES];
+  for (uint8_t id = 0; id < MAX_TEMPERATURE_SENSORS; id++) {
+    if (topics.subscribers(sensorTopics[id]) == 0) {
+      continue;
+    }
+    size_t subsetCount = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (samples[i].sensor == id) {
+        subset[subsetCount++] = samples[i];
+      }
+    }
+    if (subsetCount > 0) {
+      publishSamplesToTopic(sensorTopics[id], subset, subsetCount, now);
+    }
+  }
+}
+
+/**
+ * @brief Send samples to the subscribers of one topic that are due for an update.
+ *
+ * Clients that negotiated SAMPLE_PROTOCOL get one binary frame, the others one
+ * text message of `time,sensor,temperature` rows. Each form is only built once
+ * a client needs it and is then shared by all of them.
+ *
+ * @param topic Topic ID.
+ * @param samples Samples to send, in time order.
+ * @param count Number of samples, at most SAMPLE_FRAME_MAX_SAMPLES.
+ * @param now millis() of the update.
+ */
+void publishSamplesToTopic(int topic, const Sample *samples, size_t count, uint32_t now) {
+  AsyncWebSocketMessageBuffer *frame = NULL;
+  AsyncWebSocketMessageBuffer *rows = NULL;
+  bool frameBuilt = false;
+  bool rowsBuilt = false;
+  //Under WS_BACKPRESSURE_COALESCE a batch replaces the unsent one of the same topic,
+  //alarms and replies carry no key and are never dropped
+  uint32_t coalesceKey = topic + 1;
+
+  topics.publish(topic, now, [&](uint32_t clientId) {
+    AsyncWebSocketClient *client = ws.client(clientId);
+    if (!client) {
+      return;
+    }
+    if (client->hasProtocol(SAMPLE_PROTOCOL)) {
+      if (!frameBuilt) {
+        frameBuilt = true;
+        uint8_t data[SAMPLE_FRAME_MAX];
+        size_t len = encodeSampleFrame(samples, count, data, sizeof(data));
+        frame = len > 0 ? ws.makeBuffer(data, len) : NULL;
+        if (frame) {
+          frame->lock();
+        }
+      }
+      if (frame) {
+        client->binary(frame, coalesceKey);
+      }
+    } else {
+      if (!rowsBuilt) {
+        rowsBuilt = true;
+        rows = makeSampleRows(samples, count);
+        if (rows) {
+          rows->lock();
+        }
+      }
+      if (rows) {
+        client->text(rows, coalesceKey);
+      }
+    }
+  });
+
+  //Unlocked buffers are freed by the server once every client has sent them
+  if (frame) {
+    frame->unlock();
+  }
+  if (rows) {
+    rows->unlock();
+  }
+}
+
+/**
+ * @brief Format samples as CSV rows into a WebSocket buffer.
+ *
+ * The rows are formatted twice, first to size the buffer and then into it, so
+ * no temporary copy of the whole message is needed.
+ *
+ * @param samples Samples to format.
+ * @param count Number of samples.
+ * @return Buffer holding the rows separated by line breaks, NULL if there is nothing to send.
+ */
+AsyncWebSocketMessageBuffer *makeSampleRows(const Sample *samples, size_t count) {
+  char row[SAMPLE_ROW_MAX];
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += SampleExporter::formatRow(ExportFormat::CSV, samples[i], row, sizeof(row));
+  }
+  if (total == 0) {
+    return NULL;
+  }
+
+  AsyncWebSocketMessageBuffer *buffer = ws.makeBuffer(total - 1); // Without the last line break
+  if (!buffer || !buffer->get()) {
+    return NULL;
+  }
+  uint8_t *out = buffer->get();
+  size_t pos = 0;
+  for (size_t i = 0; i < count && pos < buffer->length(); i++) {
+    size_t len = SampleExporter::formatRow(ExportFormat::CSV, samples[i], row, sizeof(row));
+    len = min(len, buffer->length() - pos);
+    memcpy(out + pos, row, len);
+    pos += len;
+  }
+  return buffer;
+}
+
+/**
+ * @brief Tell the `alarms` subscribers about probes that stopped or started answering.
+ *
+ * @param previous Valid probes of the previous acquisition cycle, one bit per sensor ID.
+ * @param current Valid probes of the last acquisition cycle.
+ */
+void publishAlarms(uint32_t previous, uint32_t current) {
+  uint32_t now = millis();
+  for (uint8_t id = 0; id < MAX_TEMPERATURE_SENSORS; id++) {
+    uint32_t bit = 1UL << id;
+    if (((previous ^ current) & bit) == 0) {
+      continue;
+    }
+    bool ok = (current & bit) != 0;
+    Serial.printf("Sensor %u %s\n", id, ok ? "recovered" : "lost");
+
+    char alarm[64];
+    int len = snprintf(alarm, sizeof(alarm), "{\"topic\":\"alarms\",\"sensor\":%u,\"state\":\"%s\"}", id, ok ? "ok" : "lost");
+    AsyncWebSocketMessageBuffer *buffer = NULL;
+    topics.publish(alarmsTopic, now, [&](uint32_t clientId) {
+      AsyncWebSocketClient *client = ws.client(clientId);
+      if (!client) {
+        return;
+      }
+      if (!buffer) {
+        buffer = ws.makeBuffer((uint8_t *)alarm, len);
+        if (!buffer) {
+          return;
+        }
+        buffer->lock();
+      }
+      client->text(buffer);
+    });
+    if (buffer) {
+      buffer->unlock();
+    }
+  }
+}
+
+/**
+ * @brief Subscribe a client to topics or unsubscribe it.
+ *
+ * @param client Client sending the request.
+ * @param names One topic name or an array of them.
+ * @param subscribe True to subscribe, false to unsubscribe.
+ * @param minIntervalMs Shortest time between two updates on each topic, in ms.
+ * @return False if a topic is unknown or full, the other topics are still applied.
+ */
+bool applySubscription(AsyncWebSocketClient *client, JSONVar names, bool subscribe, uint32_t minIntervalMs) {
+  bool isArray = JSON.typeof(names) == "array";
+  int count = isArray ? names.length() : 1;
+  bool ok = true;
+  for (int i = 0; i < count; i++) {
+    JSONVar name = isArray ? names[i] : names;
+    if (JSON.typeof(name) != "string") {
+      ok = false;
+      continue;
+    }
+    const char *topicName = (const char *)name;
+    int topic = topics.find(topicName);
+    bool applied = subscribe ? topics.subscribe(client, topic, minIntervalMs) : topics.unsubscribe(client, topic);
+    if (!applied && (subscribe || topic < 0)) {
+      char error[64];
+      snprintf(error, sizeof(error), "{\"error\":\"%s\",\"topic\":\"%.*s\"}",
+               topic < 0 ? "unknown topic" : "topic full", TOPIC_NAME_MAX, topicName);
+      client->text(error);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/**
+ * @brief Handle a subscription request of a WebSocket client.
+ *
+ * Requests are JSON text messages holding a `subscribe` or `unsubscribe`
+ * member with one topic name or an array of them, and for subscriptions an
+ * optional `interval` in ms between updates. data points into the received
+ * packet, so the request is parsed from a terminated copy.
+ *
+ * @param client Client the message came from.
  * @param arg Pointer to the WebSocket frame info.
  * @param data Pointer to the message data.
  * @param len Length of the message.
  */
-void handleWebSocketMessage(void *arg, uint8_t *data, size_t len) {
+void handleWebSocketMessage(AsyncWebSocketClient *client, void *arg, uint8_t *data, size_t len) {
   AwsFrameInfo *info = (AwsFrameInfo*)arg;
-  if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
+  if (!(info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT)) {
+    return;
+  }
+  if (len >= WS_REQUEST_MAX) {
+    client->text("{\"error\":\"request too long\"}");
+    return;
+  }
+  char request[WS_REQUEST_MAX];
+  memcpy(request, data, len);
+  request[len] = 0;
+  JSONVar message = JSON.parse(request);
+  if (JSON.typeof(message) != "object") {
+    client->text("{\"error\":\"invalid request\"}");
+    return;
+  }
+  if (message.hasOwnProperty("subscribe")) {
+    long minIntervalMs = message.hasOwnProperty("interval") ? (long)message["interval"] : 0;
+    applySubscription(client, message["subscribe"], true, max(minIntervalMs, 0L));
+  }
+  if (message.hasOwnProperty("unsubscribe")) {
+    applySubscription(client, message["unsubscribe"], false, 0);
   }
 }
 
@@ -458,13 +933,16 @@ void handleWebSocketMessage(void *arg, uint8_t *data, size_t len) {
 void onEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
   switch (type) {
     case WS_EVT_CONNECT:
-      Serial.printf("WebSocket client #%u connected from %s\n", client->id(), client->remoteIP().toString().c_str());
+      Serial.printf("WebSocket client #%u connected from %s, protocol %s\n", client->id(), client->remoteIP().toString().c_str(),
+                    client->protocol() ? client->protocol() : "none");
+      topics.subscribe(client, samplesTopic);
       break;
     case WS_EVT_DISCONNECT:
-      Serial.printf("WebSocket client #%u disconnected\n", client->id());
+      topics.remove(client);
+      Serial.printf("WebSocket client #%u disconnected, %u messages dropped\n", client->id(), client->droppedMessages());
       break;
     case WS_EVT_DATA:
-      handleWebSocketMessage(arg, data, len);
+      handleWebSocketMessage(client, arg, data, len);
       break;
     case WS_EVT_PONG:
     case WS_EVT_ERROR:
@@ -476,6 +954,17 @@ void onEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType
  * @brief Initialize WebSocket server.
  */
 void initWebSocket() {
+  samplesTopic = topics.add("samples");
+  alarmsTopic = topics.add("alarms");
+  for (uint8_t id = 0; id < MAX_TEMPERATURE_SENSORS; id++) {
+    char name[TOPIC_NAME_MAX];
+    snprintf(name, sizeof(name), "sensor/%u", id);
+    sensorTopics[id] = topics.add(name);
+  }
+  ws.addProtocol(SAMPLE_PROTOCOL);
+  //A stalled client keeps at most one unsent sample batch per topic instead of holding up
+  //memory and the other clients, its alarms and replies are never dropped
+  ws.setBackpressure(WS_BACKPRESSURE_COALESCE);
   ws.onEvent(onEvent);
   server.addHandler(&ws);
 }
@@ -0,0 +1,108 @@
+/**
+ * @file FakeNtp.h
+ * @brief UDP stand-in that records NTP requests and replays server answers.
+ */
+
+#pragma once
+
+#include <Udp.h>
+#include <deque>
+#include <vector>
+
+// Offset between the NTP era (1900) and the Unix epoch, in s
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+class FakeNtp : public UDP {
+  public:
+    struct Datagram {
+      uint32_t to;
+      std::vector<uint8_t> data;
+    };
+
+    std::vector<Datagram> sent;
+    int namedPackets = 0;  // Packets addressed by name, which would block on a lookup
+
+    uint8_t begin(uint16_t) override { return 1; }
+    void stop() override {}
+
+    int beginPacket(IPAddress ip, uint16_t) override {
+      _packet = Datagram{ip, {}};
+      return 1;
+    }
+
+    int beginPacket(const char *, uint16_t) override {
+      namedPackets++;
+      _packet = Datagram{0, {}};
+      return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override {
+      _packet.data.insert(_packet.data.end(), buffer, buffer + size);
+      return size;
+    }
+
+    int endPacket() override {
+      sent.push_back(_packet);
+      return 1;
+    }
+
+    int parsePacket() override {
+      if (_inbox.empty()) {
+        return 0;
+      }
+      _current = _inbox.front();
+      _inbox.pop_front();
+      return _current.size();
+    }
+
+    int read(unsigned char *buffer, size_t len) override {
+      size_t n = min(len, _current.size());
+      memcpy(buffer, _current.data(), n);
+      _current.clear();
+      return n;
+    }
+
+    void flush() override { _current.clear(); }
+
+    /**
+     * @brief Queue the answer of a server to a request it got.
+     *
+     * @param request Request being answered.
+     * @param receivedMs Unix time in ms at which the server got the request.
+     * @param sentMs Unix time in ms at which the server sent the answer.
+     */
+    void answer(const Datagram &request, int64_t receivedMs, int64_t sentMs) {
+      std::vector<uint8_t> packet(48, 0);
+      packet[0] = 0x24;   // No leap warning, version 4, server mode
+      packet[1] = 1;      // Stratum
+      packet[16] = 0xE0;  // Reference timestamp, only checked for being set
+      memcpy(&packet[24], &request.data[40], 8);
+      putTimestamp(&packet[32], receivedMs);
+      putTimestamp(&packet[40], sentMs);
+      _inbox.push_back(packet);
+    }
+
+    /**
+     * @brief Answer every request sent so far, the server clock reading trueMs + serverOffsetMs.
+     */
+    void answerAll(int64_t trueMs, int64_t serverOffsetMs = 0) {
+      for (const Datagram &request : sent) {
+        answer(request, trueMs + serverOffsetMs, trueMs + serverOffsetMs);
+      }
+      sent.clear();
+    }
+
+  private:
+    Datagram _packet;
+    std::deque<std::vector<uint8_t>> _inbox;
+    std::vector<uint8_t> _current;
+
+    static void putTimestamp(uint8_t *field, int64_t unixMs) {
+      uint64_t seconds = unixMs / 1000 + NTP_UNIX_OFFSET;
+      uint64_t fraction = (((uint64_t)(unixMs % 1000) << 32) + 999) / 1000;  // Rounded up so it reads back exactly
+      for (int i = 0; i < 4; i++) {
+        field[i] = (uint8_t)(seconds >> (24 - 8 * i));
+        field[4 + i] = (uint8_t)(fraction >> (24 - 8 * i));
+      }
+    }
+};
@@ -0,0 +1,57 @@
+/**
+ * @file HostTest.h
+ * @brief Minimal checks for the host unit tests, one executable per module.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+namespace host {
+  inline int &failures() {
+    static int count = 0;
+    return count;
+  }
+
+  /**
+   * @return Empty directory for the files of one test, ending in a slash.
+   */
+  inline std::string tempDir(const char *name) {
+    std::string dir = std::string(HOST_TEST_TMP) + "/" + name;
+    std::string command = "rm -rf '" + dir + "' && mkdir -p '" + dir + "'";
+    if (system(command.c_str()) != 0) {
+      fprintf(stderr, "Cannot create %s\n", dir.c_str());
+      exit(1);
+    }
+    return dir + "/";
+  }
+}
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      host::failures()++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(actual, expected) \
+  do { \
+    long long a_ = (long long)(actual); \
+    long long e_ = (long long)(expected); \
+    if (a_ != e_) { \
+      printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #actual, #expected, a_, e_); \
+      host::failures()++; \
+    } \
+  } while (0)
+
+#define RUN_TEST(test) \
+  do { \
+    int before_ = host::failures(); \
+    test(); \
+    printf("%s %s\n", host::failures() == before_ ? "PASS" : "FAIL", #test); \
+  } while (0)
+
+#define TEST_RESULT() (host::failures() == 0 ? 0 : 1)
@@ -0,0 +1,188 @@
+/**
+ * @file async_tcp_shard_test.cpp
+ * @brief Split of AsyncTCP clients between service tasks, and a threaded model of
+ *        the dispatch showing that a slow handler only holds up its own task.
+ *
+ * The split is the one AsyncTCP.cpp is built with, so the test is compiled for
+ * each CONFIG_ASYNC_TCP_TASK_COUNT it covers.
+ */
+
+#include "HostTest.h"
+#include <AsyncTCPShard.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static_assert(CONFIG_ASYNC_TCP_TASK_COUNT > 1, "with a single task there is nothing to split");
+
+const uint8_t TASKS = CONFIG_ASYNC_TCP_TASK_COUNT;
+
+void testClientsAreSpread() {
+  // Clients are heap objects, so their addresses step by the allocation size.
+  const uint32_t strides[] = {8, 16, 32, 64, 128, 200, 256, 512, 4096};
+  for (uint32_t stride : strides) {
+    unsigned counts[TASKS] = {0};
+    for (uint32_t i = 0; i < 64; i++) {
+      const void *client = (const void *)(uintptr_t)(0x3FFB2000 + i * stride);
+      uint8_t shard = async_tcp_client_shard(client);
+      CHECK(shard < TASKS);
+      CHECK_EQ(async_tcp_client_shard(client), shard);
+      counts[shard]++;
+    }
+    unsigned mean = 64 / TASKS;
+    for (uint8_t i = 0; i < TASKS; i++) {
+      CHECK(counts[i] >= mean / 2 && counts[i] <= mean * 3 / 2);
+    }
+  }
+}
+
+namespace {
+  struct Event {
+    int client;
+    int seq;
+  };
+
+  // One queue and one service thread per task, as in AsyncTCP.cpp.
+  class Dispatcher {
+    public:
+      explicit Dispatcher(int clients) : _lastSeq(clients, -1), _done(clients, 0) {
+        _queues.resize(TASKS);
+        for (uint8_t i = 0; i < TASKS; i++) {
+          _threads.push_back(std::thread(&Dispatcher::serve, this, i));
+        }
+      }
+
+      ~Dispatcher() {
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          _stopping = true;
+          _slowClient = -1;
+        }
+        _changed.notify_all();
+        for (std::thread &thread : _threads) {
+          thread.join();
+        }
+      }
+
+      uint8_t shardOf(int client) const {
+        return async_tcp_client_shard(&_clientObjects[client]);
+      }
+
+      // Handlers of this client block until release() is called.
+      void setSlowClient(int client) {
+        std::lock_guard<std::mutex> guard(_lock);
+        _slowClient = client;
+      }
+
+      void release() {
+        setSlowClient(-1);
+        _changed.notify_all();
+      }
+
+      void send(const Event &event) {
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          _queues[shardOf(event.client)].push_back(event);
+        }
+        _changed.notify_all();
+      }
+
+      // Waits until every client in clients has handled count events.
+      bool waitFor(const std::vector<int> &clients, int count) {
+        std::unique_lock<std::mutex> guard(_lock);
+        return _changed.wait_for(guard, std::chrono::seconds(5), [&] {
+          for (int client : clients) {
+            if (_done[client] < count) {
+              return false;
+            }
+          }
+          return true;
+        });
+      }
+
+      int done(int client) {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _done[client];
+      }
+
+      int misordered() {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _misordered;
+      }
+
+    private:
+      char _clientObjects[64][160];  // Stand-ins for the AsyncClient objects the events belong to
+      std::vector<std::deque<Event>> _queues;
+      std::vector<std::thread> _threads;
+      std::vector<int> _lastSeq;
+      std::vector<int> _done;
+      int _slowClient = -1;
+      int _misordered = 0;
+      bool _stopping = false;
+      std::mutex _lock;
+      std::condition_variable _changed;
+
+      void serve(uint8_t shard) {
+        std::unique_lock<std::mutex> guard(_lock);
+        for (;;) {
+          _changed.wait(guard, [&] { return _stopping || !_queues[shard].empty(); });
+          if (_queues[shard].empty()) {
+            return;
+          }
+          Event event = _queues[shard].front();
+          _queues[shard].pop_front();
+          // A slow handler stalls only this thread, waiting lets the others go on.
+          _changed.wait(guard, [&] { return _slowClient != event.client; });
+          _misordered += event.seq != _lastSeq[event.client] + 1;
+          _lastSeq[event.client] = event.seq;
+          _done[event.client]++;
+          _changed.notify_all();
+        }
+      }
+  };
+}
+
+void testSlowHandlerOnlyBlocksItsTask() {
+  const int CLIENTS = 32;
+  const int EVENTS = 20;
+  Dispatcher dispatcher(CLIENTS);
+
+  std::vector<int> sameTask;
+  std::vector<int> otherTask;
+  for (int client = 1; client < CLIENTS; client++) {
+    (dispatcher.shardOf(client) == dispatcher.shardOf(0) ? sameTask : otherTask).push_back(client);
+  }
+  CHECK(!otherTask.empty());
+
+  dispatcher.setSlowClient(0);
+  for (int seq = 0; seq < EVENTS; seq++) {
+    for (int client = 0; client < CLIENTS; client++) {
+      dispatcher.send(Event{client, seq});
+    }
+  }
+
+  // Clients of the other task run to the end while client 0 is stuck, and so
+  // is every client queued behind it.
+  CHECK(dispatcher.waitFor(otherTask, EVENTS));
+  CHECK_EQ(dispatcher.done(0), 0);
+  for (int client : sameTask) {
+    CHECK_EQ(dispatcher.done(client), 0);
+  }
+
+  dispatcher.release();
+  std::vector<int> all;
+  for (int client = 0; client < CLIENTS; client++) {
+    all.push_back(client);
+  }
+  CHECK(dispatcher.waitFor(all, EVENTS));
+  CHECK_EQ(dispatcher.misordered(), 0);
+}
+
+int main() {
+  RUN_TEST(testClientsAreSpread);
+  RUN_TEST(testSlowHandlerOnlyBlocksItsTask);
+  return TEST_RESULT();
+}
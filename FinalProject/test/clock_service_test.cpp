@@ -0,0 +1,187 @@
+/**
+ * @file clock_service_test.cpp
+ * @brief ClockService and the drift estimate of NTPClient against a scripted NTP server.
+ */
+
+#include "HostTest.h"
+#include "FakeNtp.h"
+#include "ClockService.h"
+
+namespace {
+  const char *SERVERS[] = {"192.168.1.5"};
+  const int64_t TRUE_BASE_MS = 1700000000000LL;
+
+  // Answers the request in flight with the server clock reading trueMs and
+  // lets the service pick the answer up.
+  bool answerSync(ClockService &clock, FakeNtp &udp, int64_t trueMs) {
+    if (udp.sent.empty()) {
+      return false;
+    }
+    udp.answerAll(trueMs);
+    return clock.update();
+  }
+}
+
+void testTimeBeforeFirstSync() {
+  FakeNtp udp;
+  NTPClient ntp(udp, SERVERS, 1, 0, 60000);
+  ClockService clock(ntp, 60000, 3600000);
+
+  CHECK(!clock.synced());
+  uint64_t before = clock.nowMs();
+  host::advanceMs(1234);
+  CHECK_EQ(clock.nowMs() - before, 1234);
+}
+
+void testSyncsOnlyWhenDue() {
+  FakeNtp udp;
+  NTPClient ntp(udp, SERVERS, 1, 0, 60000);
+  ClockService clock(ntp, 60000, 60000);
+  int64_t offsetMs = TRUE_BASE_MS - (int64_t)millis();
+
+  CHECK(!clock.update());
+  CHECK_EQ(udp.sent.size(), 1);
+  CHECK(answerSync(clock, udp, offsetMs + millis()));
+  CHECK(clock.synced());
+  CHECK_EQ((int64_t)clock.nowMs(), offsetMs + (int64_t)millis());
+
+  // Reading the clock and calling update() in between never reaches the network.
+  size_t requests = 0;
+  for (int i = 0; i < 5999; i++) {
+    host::advanceMs(10);
+    CHECK(!clock.update());
+    CHECK_EQ((int64_t)clock.nowMs(), offsetMs + (int64_t)millis());
+    requests += udp.sent.size();
+  }
+  CHECK_EQ(requests, 0);
+  host::advanceMs(10);
+  clock.update();
+  CHECK_EQ(udp.sent.size(), 1);
+}
+
+void testIntervalDoublesWhileStable() {
+  FakeNtp udp;
+  NTPClient ntp(udp, SERVERS, 1, 0, 60000);
+  ClockService clock(ntp, 60000, 300000);
+  int64_t offsetMs = TRUE_BASE_MS - (int64_t)millis();
+
+  clock.update();
+  CHECK(answerSync(clock, udp, offsetMs + millis()));
+  CHECK_EQ(clock.syncInterval(), 60000);
+
+  const unsigned long expected[] = {120000, 240000, 300000, 300000};
+  for (unsigned long interval : expected) {
+    host::advanceMs(clock.syncInterval());
+    clock.update();
+    CHECK(answerSync(clock, udp, offsetMs + millis()));
+    CHECK_EQ(clock.syncInterval(), interval);
+  }
+
+  // A large correction starts over from the shortest interval.
+  host::advanceMs(clock.syncInterval());
+  clock.update();
+  CHECK(answerSync(clock, udp, offsetMs + millis() + 500));
+  CHECK_EQ(clock.syncInterval(), 60000);
+  CHECK_EQ((int64_t)clock.nowMs(), offsetMs + (int64_t)millis() + 500);
+}
+
+void testFailedSyncIsRetried() {
+  FakeNtp udp;
+  NTPClient ntp(udp, SERVERS, 1, 0, 60000);
+  ntp.setTimeout(500);
+  ClockService clock(ntp, 60000, 60000, 5000);
+  int64_t offsetMs = TRUE_BASE_MS - (int64_t)millis();
+
+  clock.update();
+  CHECK_EQ(udp.sent.size(), 1);
+  udp.sent.clear();
+  host::advanceMs(500);
+  CHECK(!clock.update());
+  CHECK(!clock.synced());
+
+  // Retried after the retry interval, not the sync interval.
+  host::advanceMs(4000);
+  clock.update();
+  CHECK(udp.sent.empty());
+  host::advanceMs(1000);
+  clock.update();
+  CHECK_EQ(udp.sent.size(), 1);
+  CHECK(answerSync(clock, udp, offsetMs + millis()));
+  CHECK(clock.synced());
+}
+
+namespace {
+  // True time next to a local clock that is off by a fixed rate, positive when
+  // the local clock runs slow.
+  struct DriftingClock {
+    double trueMs;
+    double ppm;
+
+    void advance(unsigned long localMs) {
+      host::advanceMs(localMs);
+      trueMs += localMs * (1 + ppm / 1e6);
+    }
+
+    int64_t now() const { return (int64_t)llround(trueMs); }
+  };
+
+  // Syncs every intervalMs of local time, returns the drift measured at the end.
+  float measureDrift(double ppm, int syncs, unsigned long intervalMs) {
+    FakeNtp udp;
+    NTPClient ntp(udp, SERVERS, 1, 0, 60000);
+    DriftingClock world = {(double)TRUE_BASE_MS, ppm};
+    for (int i = 0; i < syncs; i++) {
+      CHECK(ntp.beginUpdate());
+      udp.answerAll(world.now());
+      CHECK_EQ(ntp.poll(), NTP_UPDATE_SUCCESS);
+      world.advance(intervalMs);
+    }
+    return ntp.getDriftPpm();
+  }
+}
+
+void testDriftConverges() {
+  const double rates[] = {0, 40, -40, 150, -300, 480};
+  for (double ppm : rates) {
+    float measured = measureDrift(ppm, 8, 600000);
+    CHECK(fabs(measured - ppm) < 2);
+  }
+
+  // A baseline too short to measure over is extended by later syncs.
+  CHECK(measureDrift(100, 2, NTP_DRIFT_MIN_INTERVAL - 1) == 0);
+  CHECK(measureDrift(100, 4, NTP_DRIFT_MIN_INTERVAL - 1) != 0);
+  // So are rates no oscillator has, they come from a bad answer.
+  CHECK(measureDrift(2000, 8, 600000) == 0);
+}
+
+void testDriftIsCompensatedBetweenSyncs() {
+  FakeNtp udp;
+  NTPClient ntp(udp, SERVERS, 1, 0, 60000);
+  ClockService clock(ntp, 600000, 600000);
+  DriftingClock world = {(double)TRUE_BASE_MS, 120};
+
+  for (int i = 0; i < 8; i++) {
+    clock.update();
+    CHECK(answerSync(clock, udp, world.now()));
+    world.advance(600000);
+  }
+
+  // Uncorrected, a 120 ppm error adds up to 432 ms over an hour.
+  clock.update();
+  CHECK(answerSync(clock, udp, world.now()));
+  for (int minute = 0; minute < 60; minute++) {
+    world.advance(60000);
+    CHECK(llabs((int64_t)clock.nowMs() - world.now()) <= 10);
+  }
+  CHECK(llabs((int64_t)ntp.getEpochMillis() - world.now()) <= 10);
+}
+
+int main() {
+  RUN_TEST(testTimeBeforeFirstSync);
+  RUN_TEST(testSyncsOnlyWhenDue);
+  RUN_TEST(testIntervalDoublesWhileStable);
+  RUN_TEST(testFailedSyncIsRetried);
+  RUN_TEST(testDriftConverges);
+  RUN_TEST(testDriftIsCompensatedBetweenSyncs);
+  return TEST_RESULT();
+}
@@ -0,0 +1,126 @@
+/**
+ * @file downsampler_test.cpp
+ * @brief Bucketing of Downsampler and the CSV stream of DownsampledExporter.
+ */
+
+#include "HostTest.h"
+#include "Downsampler.h"
+#include <string>
+
+namespace {
+  Sample makeSample(uint32_t epoch, int16_t centiC, uint8_t sensor) {
+    Sample sample = {};
+    sample.epoch = epoch;
+    sample.centiC = centiC;
+    sample.sensor = sensor;
+    return sample;
+  }
+
+  // Runs the exporter to the end through a buffer of the given size.
+  std::string drain(DownsampledExporter &exporter, size_t chunk) {
+    std::string out;
+    uint8_t buf[256];
+    size_t n;
+    while ((n = exporter.fill(buf, chunk)) > 0) {
+      out.append((const char *)buf, n);
+    }
+    return out;
+  }
+
+  size_t countLines(const std::string &text) {
+    size_t lines = 0;
+    for (char c : text) {
+      lines += c == '\n';
+    }
+    return lines;
+  }
+}
+
+void testBuckets() {
+  Downsampler downsampler(10, 3);
+  CHECK_EQ(downsampler.bucketSize(), 4);
+
+  SampleBucket bucket;
+  int16_t temps[] = {100, -50, 300, 250, 10, 20, 30, 40, 7, 9};
+  size_t buckets = 0;
+  for (uint32_t i = 0; i < 10; i++) {
+    if (downsampler.add(makeSample(1000 + i, temps[i], 2), bucket)) {
+      buckets++;
+      if (buckets == 1) {
+        CHECK_EQ(bucket.count, 4);
+        CHECK_EQ(bucket.minC, -50);
+        CHECK_EQ(bucket.maxC, 300);
+        CHECK_EQ(bucket.avgC, 150);
+        CHECK_EQ(bucket.epoch, 1001);
+        CHECK_EQ(bucket.sensor, 2);
+      }
+    }
+  }
+  CHECK_EQ(buckets, 2);
+  CHECK(downsampler.flush(bucket));
+  CHECK_EQ(bucket.count, 2);
+  CHECK_EQ(bucket.avgC, 8);
+  CHECK(!downsampler.flush(bucket));
+}
+
+void testBucketSizeNeverZero() {
+  CHECK_EQ(Downsampler(0, 0).bucketSize(), 1);
+  CHECK_EQ(Downsampler(5, 100).bucketSize(), 1);
+}
+
+void testBucketRow() {
+  SampleBucket bucket = {86400 + 3661, -5, 2150, 1050, 12, 3};
+  char row[SAMPLE_ROW_MAX];
+  CHECK_EQ(DownsampledExporter::formatRow(bucket, row, sizeof(row)), 40);
+  CHECK(strcmp(row, "1970-01-02 01:01:01,3,10.50,-0.05,21.50\n") == 0);
+}
+
+void testExportPicksSensorFromSharedStore() {
+  // Three probes sampled together: picking one must still give it the full number of points.
+  fs::FS fs(host::tempDir("downsample"));
+  SampleStore store(fs, "samples.bin", 1000);
+  CHECK(store.begin());
+  for (uint32_t i = 0; i < 300; i++) {
+    for (uint8_t sensor = 0; sensor < 3; sensor++) {
+      CHECK(store.append(makeSample(1700000000 + i * 30, 2000 + sensor, sensor)));
+    }
+  }
+
+  DownsampledExporter one(store, 0, UINT32_MAX, 10, 1, 3);
+  std::string csv = drain(one, 7);
+  CHECK_EQ(countLines(csv), 1 + 10);
+  CHECK(csv.compare(0, 32, "Time,Sensor,Temperature,Min,Max\n") == 0);
+  CHECK(csv.find(",0,") == std::string::npos);
+  CHECK(csv.find(",2,") == std::string::npos);
+
+  DownsampledExporter all(store, 0, UINT32_MAX, 10, UINT32_MAX, 3);
+  CHECK_EQ(countLines(drain(all, 256)), 1 + 3 * 10);
+}
+
+void testExportRange() {
+  fs::FS fs(host::tempDir("downsample-range"));
+  SampleStore store(fs, "samples.bin", 1000);
+  CHECK(store.begin());
+  for (uint32_t i = 0; i < 100; i++) {
+    CHECK(store.append(makeSample(1000 + i, (int16_t)i, 0)));
+  }
+
+  // Samples 1010 to 1019 in buckets of five.
+  DownsampledExporter exporter(store, 1010, 1019, 2, UINT32_MAX, 1);
+  std::string csv = drain(exporter, 64);
+  CHECK_EQ(countLines(csv), 3);
+  CHECK(csv.find("1970-01-01 00:16:52,0,0.12,0.10,0.14\n") != std::string::npos);
+  CHECK(csv.find("1970-01-01 00:16:57,0,0.17,0.15,0.19\n") != std::string::npos);
+
+  DownsampledExporter empty(store, 5000, 6000, 10, UINT32_MAX, 1);
+  CHECK(drain(empty, 64) == "Time,Sensor,Temperature,Min,Max\n");
+}
+
+int main() {
+  RUN_TEST(testBuckets);
+  RUN_TEST(testBucketSizeNeverZero);
+  RUN_TEST(testBucketRow);
+  RUN_TEST(testExportPicksSensorFromSharedStore);
+  RUN_TEST(testExportRange);
+  return TEST_RESULT();
+}
@@ -0,0 +1,258 @@
+/**
+ * @file Arduino.h
+ * @brief Host stand-in for the parts of the Arduino core and FreeRTOS the
+ *        application modules use, so they can be unit tested on a PC.
+ *
+ * Time only moves when a test advances it with host::advanceMs(), which makes
+ * timeouts and drift reproducible.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+namespace host {
+  /**
+   * @return Simulated time since boot in µs, shared by millis() and esp_timer_get_time().
+   */
+  inline uint64_t &micros() {
+    static uint64_t now = 0;
+    return now;
+  }
+
+  inline void advanceMs(uint64_t ms) {
+    micros() += ms * 1000;
+  }
+}
+
+inline unsigned long millis() {
+  return (unsigned long)(host::micros() / 1000);
+}
+
+inline void delay(unsigned long ms) {
+  host::advanceMs(ms);
+}
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define memcpy_P memcpy
+#define F(s) ((const __FlashStringHelper *)(s))
+#define FPSTR(s) ((const __FlashStringHelper *)(s))
+
+class __FlashStringHelper;
+
+// The parts of the Arduino String the application and the web server use.
+class String {
+  public:
+    String(const char *text = "") : _text(text ? text : "") {}
+    String(const __FlashStringHelper *text) : String((const char *)text) {}
+    explicit String(char c) : _text(1, c) {}
+    explicit String(int value, unsigned char base = 10) : _text(format(base == 16 ? "%x" : "%d", value)) {}
+    explicit String(unsigned value) : _text(std::to_string(value)) {}
+    explicit String(long value) : _text(std::to_string(value)) {}
+    explicit String(unsigned long value) : _text(std::to_string(value)) {}
+
+    const char *c_str() const { return _text.c_str(); }
+    unsigned int length() const { return _text.length(); }
+    bool reserve(unsigned int size) { _text.reserve(size); return true; }
+    explicit operator bool() const { return true; }
+
+    char charAt(unsigned int i) const { return i < _text.size() ? _text[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    char &operator[](unsigned int i) { return _text[i]; }
+
+    int indexOf(char c, unsigned int from = 0) const { return found(_text.find(c, from)); }
+    int indexOf(const char *text, unsigned int from = 0) const { return found(_text.find(text, from)); }
+    int indexOf(const String &text, unsigned int from = 0) const { return found(_text.find(text._text, from)); }
+    int lastIndexOf(char c) const { return found(_text.rfind(c)); }
+    int lastIndexOf(const String &text) const { return found(_text.rfind(text._text)); }
+
+    String substring(unsigned int from) const { return substring(from, _text.size()); }
+    String substring(unsigned int from, unsigned int to) const {
+      if (from > to) {
+        std::swap(from, to);
+      }
+      if (from >= _text.size()) {
+        return String();
+      }
+      return String(_text.substr(from, to - from).c_str());
+    }
+
+    bool equals(const String &other) const { return _text == other._text; }
+    bool equalsIgnoreCase(const String &other) const {
+      return _text.size() == other._text.size() && strcasecmp(_text.c_str(), other._text.c_str()) == 0;
+    }
+    bool startsWith(const String &prefix) const { return _text.compare(0, prefix._text.size(), prefix._text) == 0; }
+    bool endsWith(const String &suffix) const {
+      return _text.size() >= suffix._text.size()
+          && _text.compare(_text.size() - suffix._text.size(), suffix._text.size(), suffix._text) == 0;
+    }
+
+    long toInt() const { return atol(_text.c_str()); }
+    void toLowerCase() { for (char &c : _text) c = tolower(c); }
+    void toUpperCase() { for (char &c : _text) c = toupper(c); }
+    void trim() {
+      size_t first = _text.find_first_not_of(" \t\r\n");
+      size_t last = _text.find_last_not_of(" \t\r\n");
+      _text = first == std::string::npos ? std::string() : _text.substr(first, last - first + 1);
+    }
+    void replace(const String &from, const String &to) {
+      for (size_t p = 0; (p = _text.find(from._text, p)) != std::string::npos; p += to._text.size()) {
+        _text.replace(p, from._text.size(), to._text);
+      }
+    }
+    void remove(unsigned int index, unsigned int count = UINT32_MAX) { _text.erase(index, count); }
+
+    bool concat(const String &text) { _text += text._text; return true; }
+    bool concat(const char *text) { _text += text; return true; }
+    bool concat(char c) { _text += c; return true; }
+    bool concat(int value) { _text += std::to_string(value); return true; }
+    bool concat(unsigned int value) { _text += std::to_string(value); return true; }
+    bool concat(long value) { _text += std::to_string(value); return true; }
+    bool concat(unsigned long value) { _text += std::to_string(value); return true; }
+    // Reads exactly len bytes, unlike arduino-esp32 which also copies text[len]
+    bool concat(const char *text, unsigned int len) { _text.append(text, len); return true; }
+
+    template <typename T>
+    String &operator+=(const T &value) { concat(value); return *this; }
+
+    bool operator==(const String &other) const { return _text == other._text; }
+    bool operator==(const char *text) const { return _text == text; }
+    bool operator!=(const String &other) const { return _text != other._text; }
+    bool operator!=(const char *text) const { return _text != text; }
+    bool operator<(const String &other) const { return _text < other._text; }
+
+  private:
+    std::string _text;
+
+    static int found(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+
+    static std::string format(const char *format, int value) {
+      char buf[16];
+      snprintf(buf, sizeof(buf), format, value);
+      return buf;
+    }
+};
+
+template <typename T>
+inline String operator+(const String &text, const T &value) {
+  String out(text);
+  out += value;
+  return out;
+}
+
+inline String operator+(const char *text, const String &value) {
+  String out(text);
+  out += value;
+  return out;
+}
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) {
+      for (size_t i = 0; i < size; i++) {
+        write(buf[i]);
+      }
+      return size;
+    }
+    size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+    size_t print(const String &text) { return print(text.c_str()); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+class HostSerial {
+  public:
+    void begin(unsigned long) {}
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+      va_list args;
+      va_start(args, format);
+      int n = vprintf(format, args);
+      va_end(args);
+      return n < 0 ? 0 : n;
+    }
+
+    size_t print(const char *text) { return ::printf("%s", text); }
+    size_t print(const String &text) { return print(text.c_str()); }
+    size_t println(const char *text = "") { return ::printf("%s\n", text); }
+    size_t println(const String &text) { return println(text.c_str()); }
+};
+
+static HostSerial Serial __attribute__((unused));
+
+// FreeRTOS semaphores and critical sections, backed by host mutexes.
+
+namespace host {
+  // Binary semaphore, FreeRTOS mutexes are binary semaphores that start given.
+  struct Semaphore {
+    std::mutex lock;
+    std::condition_variable given;
+    bool available;
+  };
+}
+
+typedef host::Semaphore *SemaphoreHandle_t;
+typedef std::recursive_mutex portMUX_TYPE;
+
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->lock()
+#define portEXIT_CRITICAL(mux) (mux)->unlock()
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+  SemaphoreHandle_t semaphore = new host::Semaphore();
+  semaphore->available = false;
+  return semaphore;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  SemaphoreHandle_t semaphore = xSemaphoreCreateBinary();
+  semaphore->available = true;
+  return semaphore;
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  delete semaphore;
+}
+
+inline int xSemaphoreTake(SemaphoreHandle_t semaphore, unsigned long) {
+  std::unique_lock<std::mutex> guard(semaphore->lock);
+  semaphore->given.wait(guard, [semaphore] { return semaphore->available; });
+  semaphore->available = false;
+  return 1;
+}
+
+inline int xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  std::lock_guard<std::mutex> guard(semaphore->lock);
+  semaphore->available = true;
+  semaphore->given.notify_one();
+  return 1;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file DallasTemperature.h
+ * @brief Host stand-in for the DS18B20 bus driver.
+ *
+ * The bus is a list of probes that tests plug in and pull out. Every probe
+ * reads its own temperature.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+#include <string.h>
+#include <vector>
+
+#define DEVICE_DISCONNECTED_C -127
+
+typedef uint8_t DeviceAddress[8];
+
+class DallasTemperature {
+  public:
+    struct Probe {
+      DeviceAddress address;
+      float tempC;
+    };
+
+    void plug(uint8_t serial, float tempC) {
+      Probe probe = {{0x28, serial, 0, 0, 0, 0, 0, 0}, tempC};
+      _probes.push_back(probe);
+    }
+
+    void unplug(uint8_t serial) {
+      for (size_t i = 0; i < _probes.size(); i++) {
+        if (_probes[i].address[1] == serial) {
+          _probes.erase(_probes.begin() + i);
+          return;
+        }
+      }
+    }
+
+    void begin() {}
+    void setWaitForConversion(bool) {}
+    uint8_t getResolution() { return 12; }
+    int16_t millisToWaitForConversion(uint8_t) { return 750; }
+    void requestTemperatures() {}
+    uint8_t getDeviceCount() { return (uint8_t)_probes.size(); }
+    bool validFamily(const uint8_t *address) { return address[0] == 0x28; }
+
+    bool getAddress(uint8_t *address, uint8_t index) {
+      if (index >= _probes.size()) {
+        return false;
+      }
+      memcpy(address, _probes[index].address, sizeof(DeviceAddress));
+      return true;
+    }
+
+    float getTempC(const uint8_t *address) {
+      for (const Probe &probe : _probes) {
+        if (memcmp(probe.address, address, sizeof(DeviceAddress)) == 0) {
+          return probe.tempC;
+        }
+      }
+      return DEVICE_DISCONNECTED_C;
+    }
+
+  private:
+    std::vector<Probe> _probes;
+};
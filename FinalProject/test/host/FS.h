@@ -0,0 +1,106 @@
+/**
+ * @file FS.h
+ * @brief Host stand-in for the Arduino file system API, backed by a directory.
+ *
+ * Writes go straight to the disk without buffering. A write budget can be set
+ * to make writes come up short once it is spent, which cuts a store off in the
+ * middle of an update the way a power loss would.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+#include <memory>
+#include <unistd.h>
+
+namespace fs {
+
+  class File {
+    public:
+      File() {}
+      File(FILE *file, std::shared_ptr<size_t> budget, const char *name)
+        : _file(file, fclose), _budget(budget), _name(name) {
+        setvbuf(file, NULL, _IONBF, 0);
+      }
+
+      explicit operator bool() const { return (bool)_file; }
+
+      bool seek(uint32_t pos) {
+        return _file && fseek(_file.get(), pos, SEEK_SET) == 0;
+      }
+
+      size_t read(uint8_t *buf, size_t size) {
+        return _file ? fread(buf, 1, size, _file.get()) : 0;
+      }
+
+      size_t write(const uint8_t *buf, size_t size) {
+        if (!_file) {
+          return 0;
+        }
+        size = min(size, *_budget);
+        *_budget -= size;
+        return fwrite(buf, 1, size, _file.get());
+      }
+
+      size_t size() {
+        long pos = ftell(_file.get());
+        fseek(_file.get(), 0, SEEK_END);
+        long end = ftell(_file.get());
+        fseek(_file.get(), pos, SEEK_SET);
+        return end;
+      }
+
+      void flush() {}
+
+      void close() { _file.reset(); }
+
+      const char *name() const { return _name.c_str(); }
+
+    private:
+      std::shared_ptr<FILE> _file;
+      std::shared_ptr<size_t> _budget;
+      std::string _name;
+  };
+
+  class FS {
+    public:
+      /**
+       * @param root Directory that paths are relative to.
+       */
+      explicit FS(const std::string &root) : _root(root), _budget(new size_t(SIZE_MAX)) {}
+
+      bool exists(const char *path) {
+        return access(resolve(path).c_str(), F_OK) == 0;
+      }
+
+      File open(const char *path, const char *mode) {
+        std::string binary = std::string(mode) + "b";
+        FILE *file = fopen(resolve(path).c_str(), binary.c_str());
+        return file ? File(file, _budget, path) : File();
+      }
+
+      bool exists(const String &path) { return exists(path.c_str()); }
+      File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+
+      bool remove(const char *path) {
+        return ::remove(resolve(path).c_str()) == 0;
+      }
+
+      bool rename(const char *from, const char *to) {
+        return ::rename(resolve(from).c_str(), resolve(to).c_str()) == 0;
+      }
+
+      /**
+       * @brief Let only this many more bytes reach the disk, across all open files.
+       */
+      void setWriteBudget(size_t bytes) { *_budget = bytes; }
+
+    private:
+      std::string _root;
+      std::shared_ptr<size_t> _budget;
+
+      std::string resolve(const char *path) const { return _root + path; }
+  };
+}
+
+using fs::File;
@@ -0,0 +1,32 @@
+/**
+ * @file IPAddress.h
+ * @brief Host stand-in for the Arduino IPv4 address.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+
+class IPAddress {
+  public:
+    IPAddress() {}
+    IPAddress(uint32_t address) : _address(address) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      : _address((uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 | (uint32_t)d << 24) {}
+
+    operator uint32_t() const { return _address; }
+    uint8_t operator[](int index) const { return (uint8_t)(_address >> (8 * index)); }
+
+    bool fromString(const char *text) {
+      unsigned a, b, c, d;
+      char rest;
+      if (sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &rest) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+        return false;
+      }
+      *this = IPAddress(a, b, c, d);
+      return true;
+    }
+
+  private:
+    uint32_t _address = 0;
+};
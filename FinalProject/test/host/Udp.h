@@ -0,0 +1,23 @@
+/**
+ * @file Udp.h
+ * @brief Host stand-in for the Arduino UDP interface.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+class UDP {
+  public:
+    virtual ~UDP() {}
+    virtual uint8_t begin(uint16_t port) = 0;
+    virtual void stop() = 0;
+    virtual int beginPacket(IPAddress ip, uint16_t port) = 0;
+    virtual int beginPacket(const char *host, uint16_t port) = 0;
+    virtual int endPacket() = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+    virtual int parsePacket() = 0;
+    virtual int read(unsigned char *buffer, size_t len) = 0;
+    virtual void flush() = 0;
+};
@@ -0,0 +1,8 @@
+/**
+ * @file WString.h
+ * @brief Host stand-in for the Arduino String header, String lives in Arduino.h.
+ */
+
+#pragma once
+
+#include "Arduino.h"
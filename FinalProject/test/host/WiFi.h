@@ -0,0 +1,9 @@
+/**
+ * @file WiFi.h
+ * @brief Host stand-in for the WiFi header, which only needs to be found.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+#include "IPAddress.h"
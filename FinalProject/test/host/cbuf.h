@@ -0,0 +1,40 @@
+/**
+ * @file cbuf.h
+ * @brief Host stand-in for the Arduino circular buffer, backed by a string.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+class cbuf {
+  public:
+    explicit cbuf(size_t size) : _size(size) {}
+
+    size_t room() const { return _size - _data.size(); }
+    size_t available() const { return _data.size(); }
+    bool empty() const { return _data.empty(); }
+
+    size_t resizeAdd(size_t add) {
+      _size += add;
+      return _size;
+    }
+
+    size_t write(const char *src, size_t len) {
+      len = len < room() ? len : room();
+      _data.append(src, len);
+      return len;
+    }
+
+    size_t read(char *dst, size_t len) {
+      len = len < _data.size() ? len : _data.size();
+      _data.copy(dst, len);
+      _data.erase(0, len);
+      return len;
+    }
+
+  private:
+    size_t _size;
+    std::string _data;
+};
@@ -0,0 +1,12 @@
+/**
+ * @file esp_timer.h
+ * @brief Host stand-in for the ESP32 monotonic timer.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+
+inline int64_t esp_timer_get_time() {
+  return (int64_t)host::micros();
+}
@@ -0,0 +1,73 @@
+/**
+ * @file dns.h
+ * @brief Host stand-in for the lwIP resolver. Names are looked up in a table
+ *        set by the test and answered at once or when the test says so.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef int8_t err_t;
+enum {
+  ERR_OK = 0,
+  ERR_INPROGRESS = -5,
+  ERR_ARG = -16
+};
+
+typedef struct ip_addr {
+  union {
+    struct {
+      uint32_t addr;
+    } ip4;
+  } u_addr;
+} ip_addr_t;
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+namespace host {
+  struct Resolver {
+    struct Lookup {
+      std::string name;
+      dns_found_callback found;
+      void *arg;
+    };
+
+    std::map<std::string, uint32_t> names;  // Address of each name, 0 if the lookup fails
+    std::vector<Lookup> pending;
+    bool cached = false;                    // Answer straight away instead of through the callback
+    int lookups = 0;
+
+    /**
+     * @brief Answer every lookup in progress through its callback.
+     */
+    void answer() {
+      std::vector<Lookup> lookups;
+      lookups.swap(pending);
+      for (const Lookup &lookup : lookups) {
+        ip_addr_t addr = {};
+        addr.u_addr.ip4.addr = names.count(lookup.name) ? names[lookup.name] : 0;
+        lookup.found(lookup.name.c_str(), addr.u_addr.ip4.addr ? &addr : NULL, lookup.arg);
+      }
+    }
+  };
+
+  inline Resolver &resolver() {
+    static Resolver instance;
+    return instance;
+  }
+}
+
+inline err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg) {
+  host::Resolver &resolver = host::resolver();
+  resolver.lookups++;
+  if (resolver.cached && resolver.names.count(hostname) && resolver.names[hostname]) {
+    addr->u_addr.ip4.addr = resolver.names[hostname];
+    return ERR_OK;
+  }
+  resolver.pending.push_back({hostname, found, callback_arg});
+  return ERR_INPROGRESS;
+}
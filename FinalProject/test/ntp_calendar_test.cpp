@@ -0,0 +1,80 @@
+/**
+ * @file ntp_calendar_test.cpp
+ * @brief Calendar math and date formatting of NTPClient, day by day against gmtime_r.
+ */
+
+#include "HostTest.h"
+#include "FakeNtp.h"
+#include <NTPClient.h>
+#include <time.h>
+
+// Evaluated by the compiler, so the math stays usable in constant expressions.
+static_assert(NTPClient::daysFromCivil(1970, 1, 1) == 0, "epoch");
+static_assert(NTPClient::daysFromCivil(2000, 3, 1) == 11017, "leap day of a 400th year");
+static_assert(NTPClient::civilFromDays(11016).month == 2 && NTPClient::civilFromDays(11016).day == 29, "2000-02-29");
+
+namespace {
+  // Last day an unsigned 32-bit epoch reaches, 2106-02-07.
+  const unsigned long LAST_DAY = 0xFFFFFFFFUL / 86400;
+}
+
+void testEveryDayMatchesGmtime() {
+  unsigned long mismatches = 0;
+  for (unsigned long day = 0; day <= LAST_DAY; day++) {
+    time_t t = (time_t)day * 86400;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    NTPDate date = NTPClient::civilFromDays(day);
+    if (date.year != tm.tm_year + 1900 || date.month != tm.tm_mon + 1 || date.day != tm.tm_mday
+        || NTPClient::daysFromCivil(date.year, date.month, date.day) != day) {
+      if (mismatches++ < 5) {
+        printf("day %lu: %u-%u-%u\n", day, date.year, date.month, date.day);
+      }
+    }
+  }
+  CHECK_EQ(mismatches, 0);
+}
+
+void testFormattedDateMatchesStrftime() {
+  FakeNtp udp;
+  NTPClient client(udp);
+  unsigned long mismatches = 0;
+  for (unsigned long day = 0; day <= LAST_DAY; day++) {
+    // A different time of day on each day, and the last second of the last day.
+    unsigned long secs = day == LAST_DAY ? 0xFFFFFFFFUL : day * 86400 + (day * 7919 + 1) % 86400;
+    time_t t = secs;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char expected[32];
+    strftime(expected, sizeof(expected), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    char date[NTP_FORMATTED_DATE_SIZE];
+    char time[NTP_FORMATTED_TIME_SIZE];
+    size_t dateLen = client.formatDate(date, sizeof(date), secs);
+    size_t timeLen = client.formatTime(time, sizeof(time), secs);
+    if (dateLen != NTP_FORMATTED_DATE_SIZE - 1 || strcmp(date, expected) != 0
+        || timeLen != NTP_FORMATTED_TIME_SIZE - 1 || strncmp(time, expected + 11, 8) != 0) {
+      if (mismatches++ < 5) {
+        printf("%lu: %s %s, expected %s\n", secs, date, time, expected);
+      }
+    }
+  }
+  CHECK_EQ(mismatches, 0);
+  CHECK(client.getFormattedDate(951782400) == "2000-02-29T00:00:00Z");
+  CHECK(client.getFormattedTime(951782399) == "23:59:59");
+}
+
+void testShortBuffersAreRefused() {
+  FakeNtp udp;
+  NTPClient client(udp);
+  char buf[NTP_FORMATTED_DATE_SIZE];
+  CHECK_EQ(client.formatDate(buf, NTP_FORMATTED_DATE_SIZE - 1, 1), 0);
+  CHECK_EQ(client.formatTime(buf, NTP_FORMATTED_TIME_SIZE - 1, 1), 0);
+}
+
+int main() {
+  RUN_TEST(testEveryDayMatchesGmtime);
+  RUN_TEST(testFormattedDateMatchesStrftime);
+  RUN_TEST(testShortBuffersAreRefused);
+  return TEST_RESULT();
+}
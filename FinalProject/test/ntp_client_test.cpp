@@ -0,0 +1,230 @@
+/**
+ * @file ntp_client_test.cpp
+ * @brief NTPClient against scripted server answers and a scripted resolver.
+ */
+
+#include "HostTest.h"
+#include "FakeNtp.h"
+#include <NTPClient.h>
+#include <lwip/dns.h>
+
+namespace {
+  const int64_t TRUE_BASE_MS = 1700000000000LL;  // Unix time at host boot
+
+  int64_t trueMs() {
+    return TRUE_BASE_MS + millis();
+  }
+
+  void resetResolver() {
+    host::resolver() = host::Resolver();
+  }
+
+  // Runs a round to the end, each server answering straight away.
+  NTPUpdateStatus runRound(NTPClient &client, FakeNtp &udp) {
+    if (!client.beginUpdate()) {
+      return NTP_UPDATE_FAILED;
+    }
+    host::advanceMs(10);
+    udp.answerAll(trueMs());
+    host::advanceMs(10);
+    return client.poll();
+  }
+}
+
+void testNamesAreResolvedOnce() {
+  resetResolver();
+  host::resolver().names["pool.example"] = IPAddress(10, 0, 0, 1);
+  host::resolver().names["time.example"] = IPAddress(10, 0, 0, 2);
+  const char *servers[] = {"192.168.1.5", "pool.example", "time.example"};
+  FakeNtp udp;
+  NTPClient client(udp, servers, 3, 0, 60000);
+
+  // Only the literal address can be asked before the lookups finish.
+  CHECK(client.beginUpdate());
+  CHECK_EQ(udp.sent.size(), 1);
+  CHECK_EQ(udp.sent[0].to, IPAddress(192, 168, 1, 5));
+  CHECK_EQ(host::resolver().pending.size(), 2);
+  host::resolver().answer();
+  udp.answerAll(trueMs());
+  CHECK_EQ(client.poll(), NTP_UPDATE_SUCCESS);
+
+  for (int round = 0; round < 5; round++) {
+    host::advanceMs(1000);
+    CHECK_EQ(runRound(client, udp), NTP_UPDATE_SUCCESS);
+  }
+  CHECK_EQ(host::resolver().lookups, 2);
+  CHECK_EQ(udp.namedPackets, 0);
+}
+
+void testCachedNameIsAskedAtOnce() {
+  resetResolver();
+  host::resolver().cached = true;
+  host::resolver().names["pool.example"] = IPAddress(10, 0, 0, 1);
+  const char *servers[] = {"pool.example"};
+  FakeNtp udp;
+  NTPClient client(udp, servers, 1, 0, 60000);
+
+  CHECK(client.beginUpdate());
+  CHECK_EQ(udp.sent.size(), 1);
+  CHECK_EQ(udp.sent[0].to, IPAddress(10, 0, 0, 1));
+}
+
+void testFailingServerIsResolvedAgain() {
+  resetResolver();
+  host::resolver().cached = true;
+  host::resolver().names["pool.example"] = IPAddress(10, 0, 0, 1);
+  const char *servers[] = {"pool.example", "192.168.1.5"};
+  FakeNtp udp;
+  NTPClient client(udp, servers, 2, 0, 60000);
+  client.setTimeout(500);
+
+  // The pool server stops answering and moves to a new address.
+  CHECK(client.beginUpdate());
+  udp.sent.erase(udp.sent.begin());
+  udp.answerAll(trueMs());
+  host::advanceMs(600);
+  CHECK_EQ(client.poll(), NTP_UPDATE_SUCCESS);
+  CHECK_EQ(client.getServerFailures(0), 1);
+  CHECK_EQ(host::resolver().lookups, 1);
+
+  host::resolver().names["pool.example"] = IPAddress(10, 0, 0, 9);
+  host::advanceMs(NTP_BACKOFF_BASE);
+  CHECK(client.beginUpdate());
+  CHECK_EQ(host::resolver().lookups, 2);
+  CHECK_EQ(udp.sent.size(), 2);
+  CHECK_EQ(udp.sent[0].to, IPAddress(10, 0, 0, 9));
+}
+
+void testUnknownNameBacksOff() {
+  resetResolver();
+  const char *servers[] = {"nowhere.example", "192.168.1.5"};
+  FakeNtp udp;
+  NTPClient client(udp, servers, 2, 0, 60000);
+
+  CHECK(client.beginUpdate());
+  host::resolver().answer();
+  udp.answerAll(trueMs());
+  CHECK_EQ(client.poll(), NTP_UPDATE_SUCCESS);
+
+  host::advanceMs(1000);
+  CHECK(client.beginUpdate());
+  CHECK_EQ(client.getServerFailures(0), 1);
+  CHECK(host::resolver().pending.empty());
+}
+
+void testLowestDelayWins() {
+  resetResolver();
+  const char *servers[] = {"192.168.1.5", "192.168.1.6"};
+  FakeNtp udp;
+  NTPClient client(udp, servers, 2, 0, 60000);
+
+  CHECK(client.beginUpdate());
+  CHECK_EQ(udp.sent.size(), 2);
+  // The first server takes 80 ms to answer and is 500 ms ahead, the second answers in 20 ms.
+  host::advanceMs(10);
+  udp.answer(udp.sent[1], trueMs(), trueMs());
+  host::advanceMs(10);
+  CHECK_EQ(client.poll(), NTP_UPDATE_PENDING);
+  host::advanceMs(60);
+  udp.answer(udp.sent[0], trueMs() - 40 + 500, trueMs() - 40 + 500);
+  CHECK_EQ(client.poll(), NTP_UPDATE_SUCCESS);
+
+  CHECK(strcmp(client.getLastServer(), "192.168.1.6") == 0);
+  CHECK_EQ(client.getLastDelay(), 20);
+  CHECK(llabs((int64_t)client.getEpochMillis() - trueMs()) <= 10);
+}
+
+void testPollNeverWaits() {
+  resetResolver();
+  const char *servers[] = {"192.168.1.5"};
+  FakeNtp udp;
+  NTPClient client(udp, servers, 1, 0, 60000);
+  client.setTimeout(500);
+
+  CHECK_EQ(client.poll(), NTP_UPDATE_IDLE);
+  CHECK(client.beginUpdate());
+  CHECK(client.isUpdating());
+  unsigned long start = millis();
+  for (int i = 0; i < 100; i++) {
+    CHECK_EQ(client.poll(), NTP_UPDATE_PENDING);
+  }
+  CHECK_EQ(millis(), start);
+
+  // A server that never answers fails the round once the timeout has passed.
+  host::advanceMs(499);
+  CHECK_EQ(client.poll(), NTP_UPDATE_PENDING);
+  host::advanceMs(1);
+  CHECK_EQ(client.poll(), NTP_UPDATE_FAILED);
+  CHECK(!client.isUpdating());
+  CHECK_EQ(client.getServerFailures(0), 1);
+  CHECK_EQ(client.poll(), NTP_UPDATE_IDLE);
+
+  // The answer to an earlier round does not count for the next one.
+  FakeNtp::Datagram late = udp.sent[0];
+  host::advanceMs(NTP_BACKOFF_BASE);
+  CHECK(client.beginUpdate());
+  udp.answer(late, trueMs(), trueMs());
+  CHECK_EQ(client.poll(), NTP_UPDATE_PENDING);
+  udp.answer(udp.sent[1], trueMs(), trueMs());
+  CHECK_EQ(client.poll(), NTP_UPDATE_SUCCESS);
+  CHECK_EQ(client.getServerFailures(0), 0);
+}
+
+void testOffsetMath() {
+  resetResolver();
+  const char *servers[] = {"192.168.1.5"};
+  FakeNtp udp;
+  NTPClient client(udp, servers, 1, 0, 60000);
+
+  // 30 ms out, 10 ms at the server, 60 ms back, with the server 2 s ahead.
+  // The round trip excludes the server time and half the asymmetry stays as error.
+  CHECK(client.beginUpdate());
+  int64_t sentAt = trueMs();
+  udp.answer(udp.sent[0], sentAt + 30 + 2000, sentAt + 40 + 2000);
+  host::advanceMs(100);
+  CHECK_EQ(client.poll(), NTP_UPDATE_SUCCESS);
+  CHECK_EQ(client.getLastDelay(), 90);
+  CHECK_EQ((int64_t)client.getEpochMillis(), trueMs() + 2000 - 15);
+  CHECK_EQ(client.getEpochTime(), (trueMs() + 2000 - 15) / 1000);
+
+  // A symmetric exchange corrects the clock to the server, the step is reported.
+  host::advanceMs(1000);
+  CHECK(client.beginUpdate());
+  sentAt = trueMs();
+  udp.answer(udp.sent[1], sentAt + 25 + 2000, sentAt + 25 + 2000);
+  host::advanceMs(50);
+  CHECK_EQ(client.poll(), NTP_UPDATE_SUCCESS);
+  CHECK_EQ(client.getLastDelay(), 50);
+  CHECK_EQ(client.getLastOffset(), 15);
+  CHECK_EQ((int64_t)client.getEpochMillis(), trueMs() + 2000);
+
+  // The time offset only shifts what is reported.
+  client.setTimeOffset(3600);
+  CHECK_EQ((int64_t)client.getEpochMillis(), trueMs() + 2000 + 3600000);
+}
+
+void testForceUpdateGivesUpAfterTimeout() {
+  resetResolver();
+  const char *servers[] = {"192.168.1.5"};
+  FakeNtp udp;
+  NTPClient client(udp, servers, 1, 0, 60000);
+  client.setTimeout(300);
+
+  unsigned long start = millis();
+  CHECK(!client.forceUpdate());
+  CHECK(millis() - start >= 300);
+  CHECK(millis() - start < 320);
+  CHECK(!client.isUpdating());
+}
+
+int main() {
+  RUN_TEST(testNamesAreResolvedOnce);
+  RUN_TEST(testCachedNameIsAskedAtOnce);
+  RUN_TEST(testFailingServerIsResolvedAgain);
+  RUN_TEST(testUnknownNameBacksOff);
+  RUN_TEST(testLowestDelayWins);
+  RUN_TEST(testPollNeverWaits);
+  RUN_TEST(testOffsetMath);
+  RUN_TEST(testForceUpdateGivesUpAfterTimeout);
+  return TEST_RESULT();
+}
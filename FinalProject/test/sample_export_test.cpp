@@ -0,0 +1,184 @@
+/**
+ * @file sample_export_test.cpp
+ * @brief CSV and NDJSON output of SampleExporter against a snprintf/gmtime_r
+ *        reference, and the formatters staying off the heap.
+ */
+
+#include "HostTest.h"
+#include "SampleExport.h"
+#include <new>
+#include <string>
+#include <time.h>
+
+namespace {
+  size_t allocations = 0;
+}
+
+// Counts every heap allocation made by the test, see testFormattingDoesNotAllocate().
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+namespace {
+  Sample makeSample(uint32_t epoch, int16_t centiC, uint8_t sensor) {
+    Sample sample = {};
+    sample.epoch = epoch;
+    sample.centiC = centiC;
+    sample.sensor = sensor;
+    return sample;
+  }
+
+  // The same sample spread over dates, sensors and signs of the temperature.
+  Sample sampleAt(uint32_t i) {
+    return makeSample(1700000000 + i * 7919, (int16_t)((int32_t)i * 37 % 8000 - 4000), i % 5);
+  }
+
+  std::string referenceRow(ExportFormat format, const Sample &sample) {
+    time_t t = sample.epoch;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char time[32];
+    strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", &tm);
+    int value = sample.centiC < 0 ? -sample.centiC : sample.centiC;
+    char temp[16];
+    snprintf(temp, sizeof(temp), "%s%d.%02d", sample.centiC < 0 ? "-" : "", value / 100, value % 100);
+
+    char row[160];
+    if (format == ExportFormat::CSV) {
+      snprintf(row, sizeof(row), "%s,%u,%s\n", time, sample.sensor, temp);
+    } else {
+      snprintf(row, sizeof(row), "{\"time\":\"%s\",\"epoch\":%u,\"sensor\":%u,\"temperature\":%s}\n",
+               time, sample.epoch, sample.sensor, temp);
+    }
+    return row;
+  }
+
+  std::string reference(ExportFormat format, uint32_t first, uint32_t end) {
+    std::string out = format == ExportFormat::CSV ? "Time,Sensor,Temperature\n" : "";
+    for (uint32_t i = first; i < end; i++) {
+      out += referenceRow(format, sampleAt(i));
+    }
+    return out;
+  }
+
+  // Runs the exporter to the end through a buffer of the given size.
+  std::string drain(SampleExporter &exporter, size_t chunk) {
+    std::string out;
+    uint8_t buf[512];
+    size_t n;
+    while ((n = exporter.fill(buf, chunk)) > 0) {
+      CHECK(n <= chunk);
+      out.append((const char *)buf, n);
+    }
+    return out;
+  }
+}
+
+void testRowsMatchReference() {
+  const int16_t temps[] = {0, 1, -1, 99, -99, 100, -100, 2550, -5500, 12500, INT16_MAX, INT16_MIN};
+  const uint32_t epochs[] = {1, 86399, 86400, 951782400, 1700000000, 2147483647, 4102444800u, UINT32_MAX};
+  for (int16_t centiC : temps) {
+    for (uint32_t epoch : epochs) {
+      Sample sample = makeSample(epoch, centiC, 255);
+      char row[SAMPLE_ROW_MAX];
+      for (ExportFormat format : {ExportFormat::CSV, ExportFormat::NDJSON}) {
+        size_t n = SampleExporter::formatRow(format, sample, row, sizeof(row));
+        std::string expected = referenceRow(format, sample);
+        CHECK(std::string(row, n) == expected);
+        CHECK_EQ(row[n], '\0');
+      }
+    }
+  }
+}
+
+void testShortBuffersAreRefused() {
+  char buf[SAMPLE_ROW_MAX];
+  CHECK_EQ(SampleExporter::formatRow(ExportFormat::CSV, makeSample(1, 0, 0), buf, SAMPLE_ROW_MAX - 1), 0);
+  CHECK_EQ(formatTimestamp(1, buf, TIMESTAMP_MAX - 1), 0);
+  CHECK_EQ(formatCentiC(0, buf, CENTIC_MAX - 1), 0);
+  CHECK_EQ(SampleExporter::formatHeader(ExportFormat::CSV, buf, 4), 0);
+  CHECK_EQ(SampleExporter::formatHeader(ExportFormat::NDJSON, buf, sizeof(buf)), 0);
+}
+
+void testExportAcrossChunkSizes() {
+  fs::FS fs(host::tempDir("export"));
+  SampleStore store(fs, "samples.bin", 300);
+  CHECK(store.begin());
+  for (uint32_t i = 0; i < 200; i++) {
+    CHECK(store.append(sampleAt(i)));
+  }
+
+  const size_t chunks[] = {1, 2, 7, 23, 95, 96, 97, 512};
+  for (ExportFormat format : {ExportFormat::CSV, ExportFormat::NDJSON}) {
+    std::string expected = reference(format, 0, 200);
+    for (size_t chunk : chunks) {
+      SampleExporter exporter(store, format, 0, UINT32_MAX);
+      CHECK(drain(exporter, chunk) == expected);
+    }
+  }
+}
+
+void testExportRange() {
+  fs::FS fs(host::tempDir("export-range"));
+  SampleStore store(fs, "samples.bin", 100);
+  CHECK(store.begin());
+  // Wrap the ring so the range spans the end of the file.
+  for (uint32_t i = 0; i < 160; i++) {
+    CHECK(store.append(sampleAt(i)));
+  }
+
+  SampleExporter all(store, ExportFormat::CSV, 0, UINT32_MAX);
+  CHECK(drain(all, 64) == reference(ExportFormat::CSV, 60, 160));
+
+  // Bounds are inclusive and need not match a sample.
+  SampleExporter some(store, ExportFormat::NDJSON, sampleAt(70).epoch, sampleAt(130).epoch + 1);
+  CHECK(drain(some, 64) == reference(ExportFormat::NDJSON, 70, 131));
+
+  SampleExporter none(store, ExportFormat::NDJSON, sampleAt(130).epoch, sampleAt(70).epoch);
+  CHECK(drain(none, 64).empty());
+
+  SampleExporter header(store, ExportFormat::CSV, 0, 1);
+  CHECK(drain(header, 64) == "Time,Sensor,Temperature\n");
+}
+
+void testFormattingDoesNotAllocate() {
+  fs::FS fs(host::tempDir("export-alloc"));
+  SampleStore store(fs, "samples.bin", 100);
+  CHECK(store.begin());
+  for (uint32_t i = 0; i < 50; i++) {
+    CHECK(store.append(sampleAt(i)));
+  }
+
+  char row[SAMPLE_ROW_MAX];
+  uint8_t buf[64];
+  size_t before = allocations;
+  for (uint32_t i = 0; i < 1000; i++) {
+    Sample sample = sampleAt(i);
+    SampleExporter::formatRow(ExportFormat::CSV, sample, row, sizeof(row));
+    SampleExporter::formatRow(ExportFormat::NDJSON, sample, row, sizeof(row));
+    formatTimestamp(sample.epoch, row, sizeof(row));
+    formatCentiC(sample.centiC, row, sizeof(row));
+  }
+  SampleExporter exporter(store, ExportFormat::NDJSON, 0, UINT32_MAX);
+  while (exporter.fill(buf, sizeof(buf)) > 0) {
+  }
+  CHECK_EQ(allocations - before, 0);
+}
+
+int main() {
+  RUN_TEST(testRowsMatchReference);
+  RUN_TEST(testShortBuffersAreRefused);
+  RUN_TEST(testExportAcrossChunkSizes);
+  RUN_TEST(testExportRange);
+  RUN_TEST(testFormattingDoesNotAllocate);
+  return TEST_RESULT();
+}
@@ -0,0 +1,156 @@
+/**
+ * @file sample_queue_test.cpp
+ * @brief Ordering, overflow and a two-thread stress run of SampleQueue.
+ */
+
+#include "HostTest.h"
+#include "SampleQueue.h"
+#include <stdint.h>
+#include <thread>
+
+namespace {
+  // Big enough that a torn copy would show up as a mismatch between the fields.
+  struct Item {
+    uint32_t seq;
+    uint32_t words[7];
+  };
+
+  Item makeItem(uint32_t seq) {
+    Item item;
+    item.seq = seq;
+    for (uint32_t i = 0; i < 7; i++) {
+      item.words[i] = seq * 2654435761u + i;
+    }
+    return item;
+  }
+
+  bool intact(const Item &item) {
+    for (uint32_t i = 0; i < 7; i++) {
+      if (item.words[i] != item.seq * 2654435761u + i) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+void testFifoAndWrap() {
+  SampleQueue<uint32_t, 8> queue;
+  CHECK(queue.empty());
+  CHECK_EQ(queue.capacity(), 7);
+
+  uint32_t next = 0;
+  uint32_t expected = 0;
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < 5; i++) {
+      CHECK(queue.push(next++));
+    }
+    CHECK_EQ(queue.size(), 5);
+    for (int i = 0; i < 5; i++) {
+      uint32_t value = UINT32_MAX;
+      CHECK(queue.pop(value));
+      CHECK_EQ(value, expected++);
+    }
+  }
+  uint32_t value;
+  CHECK(!queue.pop(value));
+  CHECK_EQ(queue.dropped(), 0);
+}
+
+void testFullQueueDropsNewItems() {
+  SampleQueue<uint32_t, 4> queue;
+  CHECK(queue.push(1));
+  CHECK(queue.push(2));
+  CHECK(queue.push(3));
+  CHECK(!queue.push(4));
+  CHECK(!queue.push(5));
+  CHECK_EQ(queue.size(), 3);
+  CHECK_EQ(queue.dropped(), 2);
+
+  // What was queued comes out untouched.
+  uint32_t value = 0;
+  CHECK(queue.pop(value));
+  CHECK_EQ(value, 1);
+  CHECK(queue.push(6));
+  for (uint32_t expected : {2u, 3u, 6u}) {
+    CHECK(queue.pop(value));
+    CHECK_EQ(value, expected);
+  }
+  CHECK(queue.empty());
+}
+
+void testProducerConsumerThreads() {
+  const uint32_t ITEMS = 500000;
+  static SampleQueue<Item, 64> queue;
+
+  // The producer keeps retrying, so nothing may be lost and everything must
+  // come out in order.
+  std::thread producer([] {
+    for (uint32_t seq = 0; seq < ITEMS; ) {
+      if (queue.push(makeItem(seq))) {
+        seq++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint32_t expected = 0;
+  uint32_t torn = 0;
+  uint32_t misordered = 0;
+  while (expected < ITEMS) {
+    Item item;
+    if (!queue.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    torn += !intact(item);
+    misordered += item.seq != expected;
+    expected = item.seq + 1;
+  }
+  producer.join();
+
+  CHECK_EQ(torn, 0);
+  CHECK_EQ(misordered, 0);
+  CHECK(queue.empty());
+}
+
+void testDroppedCountUnderLoad() {
+  const uint32_t ITEMS = 200000;
+  static SampleQueue<Item, 16> queue;
+
+  // A producer that never retries loses items, exactly as many as it counted.
+  std::thread producer([] {
+    for (uint32_t seq = 0; seq < ITEMS; seq++) {
+      queue.push(makeItem(seq));
+    }
+  });
+
+  uint32_t received = 0;
+  uint32_t last = 0;
+  bool ordered = true;
+  auto drain = [&] {
+    Item item;
+    while (queue.pop(item)) {
+      ordered &= intact(item) && (received == 0 || item.seq > last);
+      last = item.seq;
+      received++;
+    }
+  };
+  while (received + queue.dropped() < ITEMS) {
+    drain();
+  }
+  producer.join();
+  drain();
+
+  CHECK(ordered);
+  CHECK_EQ(received + queue.dropped(), ITEMS);
+}
+
+int main() {
+  RUN_TEST(testFifoAndWrap);
+  RUN_TEST(testFullQueueDropsNewItems);
+  RUN_TEST(testProducerConsumerThreads);
+  RUN_TEST(testDroppedCountUnderLoad);
+  return TEST_RESULT();
+}
@@ -0,0 +1,268 @@
+/**
+ * @file sample_store_test.cpp
+ * @brief Ring buffer behaviour of SampleStore on a file-backed host file system.
+ */
+
+#include "HostTest.h"
+#include "SampleStore.h"
+
+namespace {
+  const char *PATH = "samples.bin";
+
+  Sample makeSample(uint32_t i) {
+    Sample sample = {};
+    sample.epoch = 1700000000 + i * 10;
+    sample.centiC = (int16_t)(2000 + i % 500);
+    sample.sensor = (uint8_t)(i % 3);
+    return sample;
+  }
+
+  // Checks that the store holds exactly samples first..first+count-1 in order.
+  void checkContents(SampleStore &store, uint32_t first, uint32_t count) {
+    CHECK_EQ(store.size(), count);
+    Sample samples[50];
+    uint32_t index = 0;
+    while (index < count) {
+      size_t n = store.read(index, samples, 50);
+      CHECK(n > 0);
+      if (n == 0) {
+        return;
+      }
+      for (size_t i = 0; i < n; i++) {
+        Sample expected = makeSample(first + index + i);
+        CHECK_EQ(samples[i].epoch, expected.epoch);
+        CHECK_EQ(samples[i].centiC, expected.centiC);
+        CHECK_EQ(samples[i].sensor, expected.sensor);
+      }
+      index += n;
+    }
+  }
+
+  void appendRange(SampleStore &store, uint32_t first, uint32_t count) {
+    for (uint32_t i = first; i < first + count; i++) {
+      CHECK(store.append(makeSample(i)));
+    }
+  }
+}
+
+void testAppendAndRead() {
+  fs::FS fs(host::tempDir("append"));
+  SampleStore store(fs, PATH, 200);
+  CHECK(store.begin());
+  CHECK_EQ(store.size(), 0);
+
+  appendRange(store, 0, 70);
+  checkContents(store, 0, 70);
+
+  Sample sample;
+  CHECK_EQ(store.read(70, &sample, 1), 0);
+}
+
+void testWrapOverwritesOldest() {
+  // A capacity that is not a multiple of the page size leaves a short last page.
+  fs::FS fs(host::tempDir("wrap"));
+  SampleStore store(fs, PATH, 150);
+  CHECK(store.begin());
+
+  appendRange(store, 0, 1000);
+  checkContents(store, 1000 - 150, 150);
+}
+
+void testReopenKeepsSamples() {
+  std::string dir = host::tempDir("reopen");
+  {
+    fs::FS fs(dir);
+    SampleStore store(fs, PATH, 150);
+    CHECK(store.begin());
+    appendRange(store, 0, 333);
+    CHECK(store.flush());
+  }
+  fs::FS fs(dir);
+  SampleStore store(fs, PATH, 150);
+  CHECK(store.begin());
+  checkContents(store, 333 - 150, 150);
+
+  appendRange(store, 333, 10);
+  checkContents(store, 343 - 150, 150);
+}
+
+void testSeek() {
+  fs::FS fs(host::tempDir("seek"));
+  SampleStore store(fs, PATH, 150);
+  CHECK(store.begin());
+  CHECK_EQ(store.seek(0), 0);
+
+  appendRange(store, 0, 400);
+  uint32_t first = 400 - 150;
+  CHECK_EQ(store.seek(0), 0);
+  CHECK_EQ(store.seek(makeSample(first).epoch), 0);
+  CHECK_EQ(store.seek(makeSample(first + 42).epoch), 42);
+  CHECK_EQ(store.seek(makeSample(first + 42).epoch - 5), 42);
+  CHECK_EQ(store.seek(makeSample(399).epoch), 149);
+  CHECK_EQ(store.seek(makeSample(399).epoch + 1), 150);
+}
+
+void testBackwardClockStepIsRejected() {
+  // An NTP step back must not put an older record after a newer one, seek()
+  // searches the ring as if it were sorted.
+  std::string dir = host::tempDir("backward");
+  {
+    fs::FS fs(dir);
+    SampleStore store(fs, PATH, 150);
+    CHECK(store.begin());
+    appendRange(store, 0, 100);
+    CHECK(!store.append(makeSample(98)));
+    CHECK(!store.append(makeSample(0)));
+    checkContents(store, 0, 100);
+
+    // Samples of several probes share a timestamp.
+    Sample sameTime = makeSample(99);
+    sameTime.sensor = 2;
+    CHECK(store.append(sameTime));
+    CHECK_EQ(store.seek(makeSample(99).epoch), 99);
+    CHECK(store.flush());
+  }
+  // The newest epoch is known again after a reopen.
+  fs::FS fs(dir);
+  SampleStore store(fs, PATH, 150);
+  CHECK(store.begin());
+  CHECK_EQ(store.size(), 101);
+  CHECK(!store.append(makeSample(50)));
+  CHECK(store.append(makeSample(100)));
+  CHECK_EQ(store.seek(makeSample(42).epoch), 42);
+  CHECK_EQ(store.seek(makeSample(100).epoch), 101);
+}
+
+void testMismatchedLayoutIsMovedAside() {
+  std::string dir = host::tempDir("layout");
+  {
+    fs::FS fs(dir);
+    SampleStore store(fs, PATH, 150);
+    CHECK(store.begin());
+    appendRange(store, 0, 100);
+    CHECK(store.flush());
+  }
+  fs::FS fs(dir);
+  SampleStore store(fs, PATH, 300);
+  CHECK(store.begin());
+  CHECK_EQ(store.size(), 0);
+  CHECK(fs.exists("samples.bin.bak"));
+}
+
+void testReopenAtPageBoundary() {
+  // The cursor starts a fresh sector whose slots still hold the oldest records.
+  std::string dir = host::tempDir("boundary");
+  uint32_t capacity = 2 * SampleStore::RECORDS_PER_PAGE;
+  uint32_t total = capacity + SampleStore::RECORDS_PER_PAGE;
+  {
+    fs::FS fs(dir);
+    SampleStore store(fs, PATH, capacity);
+    CHECK(store.begin());
+    appendRange(store, 0, total);
+    CHECK(store.flush());
+  }
+  fs::FS fs(dir);
+  SampleStore store(fs, PATH, capacity);
+  CHECK(store.begin());
+  checkContents(store, total - capacity, capacity);
+  CHECK_EQ(store.seek(makeSample(total - 1).epoch), capacity - 1);
+}
+
+void testClearSurvivesReopen() {
+  std::string dir = host::tempDir("clear");
+  {
+    fs::FS fs(dir);
+    SampleStore store(fs, PATH, 150);
+    CHECK(store.begin());
+    appendRange(store, 0, 100);
+    CHECK(store.flush());
+    CHECK(store.clear());
+    CHECK_EQ(store.size(), 0);
+    CHECK(!store.append(makeSample(99)));
+  }
+  {
+    fs::FS fs(dir);
+    SampleStore store(fs, PATH, 150);
+    CHECK(store.begin());
+    CHECK_EQ(store.size(), 0);
+    appendRange(store, 100, 5);
+    CHECK(store.flush());
+  }
+  fs::FS fs(dir);
+  SampleStore store(fs, PATH, 150);
+  CHECK(store.begin());
+  checkContents(store, 100, 5);
+}
+
+void testCrashRecovery() {
+  // Cut the writes off after every possible number of bytes while samples are
+  // appended, then reopen. The store must come back with a gapless run of the
+  // samples appended, ending no earlier than the last one flushed.
+  const uint32_t capacity = 150;
+  const uint32_t committed = 140;
+  const uint32_t attempted = 40;
+  size_t budgetEnd = 4 * (SampleStore::HEADER_SIZE + SampleStore::SECTOR_SIZE);
+
+  for (size_t budget = 0; budget <= budgetEnd; budget += 7) {
+    std::string dir = host::tempDir("crash");
+    {
+      fs::FS fs(dir);
+      SampleStore store(fs, PATH, capacity);
+      CHECK(store.begin());
+      store.setFlushPolicy(4, 0);
+      appendRange(store, 0, committed);
+      CHECK(store.flush());
+
+      fs.setWriteBudget(budget);
+      for (uint32_t i = committed; i < committed + attempted; i++) {
+        store.append(makeSample(i));
+      }
+    }
+
+    fs::FS fs(dir);
+    SampleStore store(fs, PATH, capacity);
+    CHECK(store.begin());
+    uint32_t size = store.size();
+
+    CHECK(size > 0 && size <= capacity);
+    Sample newest;
+    CHECK_EQ(store.read(size - 1, &newest, 1), 1);
+    uint32_t end = (newest.epoch - makeSample(0).epoch) / 10 + 1;
+    CHECK(end >= committed && end <= committed + attempted);
+    checkContents(store, end - size, size);
+
+    // The store keeps working after the recovery.
+    appendRange(store, end, 3);
+    checkContents(store, end + 3 - min(size + 3, capacity), min(size + 3, capacity));
+  }
+}
+
+void testChecksumCatchesBitFlips() {
+  Sample sample = makeSample(7);
+  sample.check = SampleStore::checksum(sample);
+
+  uint8_t *bytes = (uint8_t *)&sample;
+  for (size_t bit = 0; bit < 8 * sizeof(Sample); bit++) {
+    Sample flipped = sample;
+    ((uint8_t *)&flipped)[bit / 8] ^= 1 << bit % 8;
+    CHECK(SampleStore::checksum(flipped) != flipped.check);
+  }
+
+  Sample zero = {};
+  CHECK(SampleStore::checksum(zero) != 0);
+  CHECK(bytes[offsetof(Sample, check)] == sample.check);
+}
+
+int main() {
+  RUN_TEST(testAppendAndRead);
+  RUN_TEST(testWrapOverwritesOldest);
+  RUN_TEST(testReopenKeepsSamples);
+  RUN_TEST(testSeek);
+  RUN_TEST(testBackwardClockStepIsRejected);
+  RUN_TEST(testMismatchedLayoutIsMovedAside);
+  RUN_TEST(testReopenAtPageBoundary);
+  RUN_TEST(testClearSurvivesReopen);
+  RUN_TEST(testCrashRecovery);
+  RUN_TEST(testChecksumCatchesBitFlips);
+  return TEST_RESULT();
+}
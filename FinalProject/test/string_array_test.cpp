@@ -0,0 +1,230 @@
+/**
+ * @file string_array_test.cpp
+ * @brief IntrusiveList and RingQueue of ESPAsyncWebServer, including that they never allocate.
+ */
+
+#include "HostTest.h"
+#include <StringArray.h>
+#include <AsyncWebSocket.h>
+#include <new>
+#include <vector>
+
+namespace {
+  size_t allocations = 0;
+}
+
+// Counts every heap allocation made by the test.
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+// Defined in AsyncWebSocket.cpp, which is not linked, the control queue only holds pointers to it.
+class AsyncWebSocketControl {};
+
+namespace {
+  struct Item : public IntrusiveListNode<Item> {
+    int value;
+    explicit Item(int v = 0) : value(v) {}
+  };
+
+  std::vector<int> values(const IntrusiveList<Item> &list) {
+    std::vector<int> out;
+    for (Item *item : list) {
+      out.push_back(item->value);
+    }
+    return out;
+  }
+}
+
+void testIntrusiveListOrderAndRemoval() {
+  Item items[6];
+  for (int i = 0; i < 6; i++) {
+    items[i].value = i;
+  }
+  std::vector<int> removed;
+  IntrusiveList<Item> list([&removed](Item *const &item) { removed.push_back(item->value); });
+
+  for (Item &item : items) {
+    list.add(&item);
+  }
+  CHECK_EQ(list.length(), 6);
+  CHECK(list.front() == &items[0]);
+  CHECK(list.nth(3) == &items[3]);
+  CHECK(list.nth(6) == nullptr);
+  CHECK_EQ(list.count_if([](Item *const &item) { return item->value % 2 == 0; }), 3);
+
+  // Removing the tail must move it back, or the next add() would be lost.
+  CHECK(list.remove(&items[5]));
+  CHECK(!list.remove(&items[5]));
+  list.add(&items[5]);
+  CHECK(values(list) == std::vector<int>({0, 1, 2, 3, 4, 5}));
+
+  CHECK(list.remove_first([](Item *const &item) { return item->value > 2; }));
+  CHECK_EQ(list.remove_if([](Item *const &item) { return item->value % 2 == 0; }), 3);
+  CHECK(values(list) == std::vector<int>({1, 5}));
+  CHECK_EQ(list.length(), 2);
+  CHECK(removed == std::vector<int>({5, 3, 0, 2, 4}));
+
+  list.add(&items[0]);
+  CHECK(values(list) == std::vector<int>({1, 5, 0}));
+  list.free();
+  CHECK(list.isEmpty());
+  CHECK_EQ(list.length(), 0);
+  CHECK(list.front() == nullptr);
+
+  // A freed list takes items again.
+  list.add(&items[2]);
+  CHECK(values(list) == std::vector<int>({2}));
+}
+
+void testRingQueueWrapAndOverflow() {
+  std::vector<int> removed;
+  RingQueue<int, 4> queue([&removed](const int &value) { removed.push_back(value); });
+  CHECK_EQ(queue.capacity(), 4);
+
+  int next = 0;
+  for (int round = 0; round < 10; round++) {
+    while (queue.add(next)) {
+      next++;
+    }
+    CHECK(queue.isFull());
+    CHECK_EQ(queue.length(), 4);
+    CHECK_EQ(queue.back(), next - 1);
+    queue.pop_front();
+    queue.pop_front();
+    CHECK_EQ(queue.front(), next - 2);
+  }
+  // Values leave in the order they came in.
+  CHECK_EQ(removed.size(), 20);
+  for (size_t i = 0; i < removed.size(); i++) {
+    CHECK_EQ(removed[i], i);
+  }
+
+  queue.pop_back();
+  CHECK_EQ(removed.back(), next - 1);
+  CHECK_EQ(queue.length(), 1);
+  queue.free();
+  CHECK(queue.isEmpty());
+  queue.pop_front();
+  CHECK(queue.isEmpty());
+}
+
+void testContainersDoNotAllocate() {
+  Item items[32];
+  IntrusiveList<Item> list;
+  RingQueue<Item *, 32> queue;
+
+  size_t before = allocations;
+  for (int round = 0; round < 100; round++) {
+    for (Item &item : items) {
+      list.add(&item);
+      queue.add(&item);
+    }
+    list.remove_if([](Item *const &item) { return item->value == 0; });
+    while (!queue.isEmpty()) {
+      queue.pop_front();
+    }
+  }
+  CHECK_EQ(allocations - before, 0);
+  CHECK(list.isEmpty());
+}
+
+void testRequestListsDoNotAllocate() {
+  // The headers and parameters a request parses, allocated before the request
+  // is counted. Linking them into the request and looking them up must not add
+  // anything on top.
+  AsyncWebHeader headers[] = {
+    AsyncWebHeader("Host", "esp32.local"),
+    AsyncWebHeader("Connection", "keep-alive"),
+    AsyncWebHeader("Accept", "text/csv"),
+    AsyncWebHeader("Accept-Encoding", "gzip"),
+  };
+  AsyncWebParameter params[] = {
+    AsyncWebParameter("from", "1700000000"),
+    AsyncWebParameter("to", "1700086400"),
+    AsyncWebParameter("points", "300"),
+  };
+  const String wanted("accept");
+  IntrusiveList<AsyncWebHeader> headerList([](AsyncWebHeader *const &header) { (void)header; });
+  IntrusiveList<AsyncWebParameter> paramList([](AsyncWebParameter *const &param) { (void)param; });
+
+  for (int request = 0; request < 100; request++) {
+    size_t before = allocations;
+    for (AsyncWebHeader &header : headers) {
+      headerList.add(&header);
+    }
+    for (AsyncWebParameter &param : params) {
+      paramList.add(&param);
+    }
+    const AsyncWebHeader *found = nullptr;
+    for (const AsyncWebHeader *header : headerList) {
+      if (header->name().equalsIgnoreCase(wanted)) {
+        found = header;
+      }
+    }
+    const AsyncWebParameter *points = paramList.nth(2);
+    headerList.free();
+    paramList.free();
+    CHECK_EQ(allocations - before, 0);
+    CHECK(found == &headers[2]);
+    CHECK(points == &params[2]);
+  }
+}
+
+void testMessageQueuesDoNotAllocate() {
+  // A WebSocket client queues, coalesces and retires messages and controls.
+  // The messages themselves are the only allocation, so they are made up front.
+  AsyncWebSocketMessage messages[WS_MAX_QUEUED_MESSAGES];
+  AsyncWebSocketControl controls[WS_MAX_QUEUED_CONTROLS];
+  IntrusiveList<AsyncWebSocketMessage> messageQueue([](AsyncWebSocketMessage *const &message) { (void)message; });
+  RingQueue<AsyncWebSocketControl *, WS_MAX_QUEUED_CONTROLS> controlQueue;
+
+  size_t sent = 0;
+  for (int message = 0; message < 1000; message++) {
+    size_t before = allocations;
+    // The slots are reused, one still waiting in the queue is taken out first.
+    AsyncWebSocketMessage *next = &messages[message % WS_MAX_QUEUED_MESSAGES];
+    messageQueue.remove(next);
+    uint32_t key = message % 4;
+    next->setCoalesceKey(key);
+    if (key) {
+      messageQueue.remove_if([key](AsyncWebSocketMessage *const &m) { return m->coalesceKey() == key; });
+    }
+    if (messageQueue.length() == WS_MAX_QUEUED_MESSAGES) {
+      messageQueue.remove(messageQueue.front());
+    }
+    messageQueue.add(next);
+    if (controlQueue.isFull()) {
+      controlQueue.pop_front();
+    }
+    controlQueue.add(&controls[message % WS_MAX_QUEUED_CONTROLS]);
+    if (message % 3 == 0) {
+      messageQueue.remove(messageQueue.front());
+      controlQueue.pop_front();
+      sent++;
+    }
+    CHECK_EQ(allocations - before, 0);
+  }
+  CHECK(sent > 0);
+  // Keyed messages coalesced down to one each, the unkeyed ones stay queued.
+  CHECK_EQ(messageQueue.count_if([](AsyncWebSocketMessage *const &m) { return m->coalesceKey() == 1; }), 1);
+  CHECK(messageQueue.length() <= WS_MAX_QUEUED_MESSAGES);
+}
+
+int main() {
+  RUN_TEST(testIntrusiveListOrderAndRemoval);
+  RUN_TEST(testRingQueueWrapAndOverflow);
+  RUN_TEST(testContainersDoNotAllocate);
+  RUN_TEST(testRequestListsDoNotAllocate);
+  RUN_TEST(testMessageQueuesDoNotAllocate);
+  return TEST_RESULT();
+}
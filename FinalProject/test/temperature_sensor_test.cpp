@@ -0,0 +1,90 @@
+/**
+ * @file temperature_sensor_test.cpp
+ * @brief Probe IDs of TemperatureSensor across unplugging, restarts and a full registry.
+ */
+
+#include "HostTest.h"
+#include "TemperatureSensor.h"
+
+namespace {
+  const char *PATH = "sensors.bin";
+}
+
+void testProbeKeepsIdWhenUnplugged() {
+  fs::FS fs(host::tempDir("unplug"));
+  DallasTemperature bus;
+  bus.plug(1, 20.0f);
+  bus.plug(2, 21.0f);
+  TemperatureSensor sensor(bus, fs, PATH);
+  sensor.begin();
+  CHECK_EQ(sensor.count(), 2);
+
+  bus.unplug(1);
+  bus.plug(3, 22.0f);
+  sensor.scan();
+  CHECK_EQ(sensor.count(), 3);
+  CHECK(!sensor.present(0));
+  CHECK_EQ(sensor.address(2)[1], 3);
+
+  bus.plug(1, 20.0f);
+  sensor.scan();
+  CHECK(sensor.present(0));
+  CHECK_EQ(sensor.address(0)[1], 1);
+}
+
+void testIdsSurviveRestart() {
+  fs::FS fs(host::tempDir("restart"));
+  DallasTemperature bus;
+  bus.plug(1, 20.0f);
+  bus.plug(2, 21.0f);
+  {
+    TemperatureSensor sensor(bus, fs, PATH);
+    sensor.begin();
+  }
+
+  // Found in another order and with the first one missing, both keep their IDs.
+  DallasTemperature rebooted;
+  rebooted.plug(3, 22.0f);
+  rebooted.plug(2, 21.0f);
+  TemperatureSensor sensor(rebooted, fs, PATH);
+  sensor.begin();
+  CHECK_EQ(sensor.count(), 3);
+  CHECK(!sensor.present(0));
+  CHECK_EQ(sensor.address(0)[1], 1);
+  CHECK_EQ(sensor.address(1)[1], 2);
+  CHECK_EQ(sensor.address(2)[1], 3);
+}
+
+void testFullRegistryIgnoresNewProbe() {
+  fs::FS fs(host::tempDir("full"));
+  DallasTemperature bus;
+  for (uint8_t i = 0; i < MAX_TEMPERATURE_SENSORS; i++) {
+    bus.plug(i, 20.0f + i);
+  }
+  TemperatureSensor sensor(bus, fs, PATH);
+  sensor.begin();
+  CHECK_EQ(sensor.count(), MAX_TEMPERATURE_SENSORS);
+
+  // The free-looking ID still belongs to the unplugged probe.
+  bus.unplug(0);
+  bus.plug(100, 30.0f);
+  sensor.scan();
+  CHECK_EQ(sensor.count(), MAX_TEMPERATURE_SENSORS);
+  CHECK(!sensor.present(0));
+  CHECK_EQ(sensor.address(0)[1], 0);
+  CHECK_EQ(sensor.present(), MAX_TEMPERATURE_SENSORS - 1);
+
+  sensor.start();
+  host::advanceMs(750);
+  CHECK(sensor.poll());
+  CHECK(!sensor.valid(0));
+  CHECK(sensor.valid(1));
+  CHECK(sensor.tempC(1) == 21.0f);
+}
+
+int main() {
+  RUN_TEST(testProbeKeepsIdWhenUnplugged);
+  RUN_TEST(testIdsSurviveRestart);
+  RUN_TEST(testFullRegistryIgnoresNewProbe);
+  return TEST_RESULT();
+}
@@ -0,0 +1,137 @@
+/**
+ * @file web_response_test.cpp
+ * @brief AsyncAbstractResponse::_ack() of ESPAsyncWebServer through windows of every size.
+ */
+
+#include "HostTest.h"
+#include <ESPAsyncWebServer.h>
+#include <string>
+
+// WebResponses.cpp only reads client() and version() of the request, so the
+// parser in WebRequest.cpp and the server it needs are left out.
+AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer *server, AsyncClient *client)
+  : _client(client), _server(server), _handler(NULL), _response(NULL), _onDisconnectfn(NULL),
+    _parseState(0), _version(1), _pathParams(nullptr), _tempObject(NULL) {
+}
+
+AsyncWebServerRequest::~AsyncWebServerRequest() {
+}
+
+namespace {
+  std::string makeBody(size_t len) {
+    std::string body;
+    for (size_t i = 0; i < len; i++) {
+      body += (char)('a' + i % 26);
+    }
+    return body;
+  }
+
+  AwsResponseFiller fillerOf(const std::string &body) {
+    return [body](uint8_t *buf, size_t maxLen, size_t index) -> size_t {
+      size_t n = min(maxLen, body.size() - index);
+      memcpy(buf, body.data() + index, n);
+      return n;
+    };
+  }
+
+  // Sends the response, the connection taking window(call) bytes on each call
+  // and acking all of it. Returns false if the response never finished.
+  template <typename Window>
+  bool drain(AsyncWebServerResponse &response, AsyncClient &client, Window window) {
+    AsyncWebServerRequest request(NULL, &client);
+    client.setSpace(window(0));
+    response._respond(&request);
+    for (int call = 1; call < 100000 && !response._finished(); call++) {
+      size_t before = client.sent().size();
+      client.setSpace(window(call));
+      response._ack(&request, before, 0);
+    }
+    return response._finished() && !response._failed();
+  }
+
+  // Splits a response into its head and its body, decoding chunked transfer coding.
+  bool parse(const std::string &sent, bool chunked, std::string &body) {
+    size_t headEnd = sent.find("\r\n\r\n");
+    if (headEnd == std::string::npos) {
+      return false;
+    }
+    size_t pos = headEnd + 4;
+    if (!chunked) {
+      body = sent.substr(pos);
+      return true;
+    }
+    body.clear();
+    for (;;) {
+      size_t lineEnd = sent.find("\r\n", pos);
+      if (lineEnd == std::string::npos) {
+        return false;
+      }
+      size_t len = strtoul(sent.substr(pos, lineEnd - pos).c_str(), NULL, 16);
+      pos = lineEnd + 2;
+      if (sent.compare(pos + len, 2, "\r\n") != 0) {
+        return false;
+      }
+      body += sent.substr(pos, len);
+      pos += len + 2;
+      if (len == 0) {
+        return pos == sent.size();
+      }
+    }
+  }
+}
+
+void testChunkedThroughSmallWindows() {
+  // Below 9 bytes nothing fits besides the chunk framing, see testChunkedHeadLeavesLittleRoom().
+  std::string body = makeBody(700);
+  for (size_t window = 9; window <= 40; window++) {
+    AsyncClient client;
+    AsyncChunkedResponse response("text/csv", fillerOf(body));
+    // The head always fits, the content windows are the small ones.
+    CHECK(drain(response, client, [window](int call) { return call == 0 ? 1000 : window; }));
+    std::string received;
+    CHECK(parse(client.sent(), true, received));
+    CHECK(received == body);
+  }
+}
+
+void testChunkedHeadLeavesLittleRoom() {
+  std::string body = makeBody(300);
+  for (size_t left = 0; left <= 12; left++) {
+    AsyncClient client;
+    AsyncChunkedResponse probe("text/csv", fillerOf(body));
+    AsyncWebServerRequest request(NULL, &client);
+    client.setSpace(10000);
+    probe._respond(&request);
+    size_t headLen = client.sent().find("\r\n\r\n") + 4;
+
+    // Only left bytes fit after the head, then the window stays too small for
+    // content for a while. The response must wait instead of ending.
+    AsyncClient tight;
+    AsyncChunkedResponse response("text/csv", fillerOf(body));
+    CHECK(drain(response, tight, [headLen, left](int call) -> size_t {
+      return call == 0 ? headLen + left : call < 9 ? call : 64;
+    }));
+    std::string received;
+    CHECK(parse(tight.sent(), true, received));
+    CHECK(received == body);
+  }
+}
+
+void testContentLengthThroughSmallWindows() {
+  std::string body = makeBody(500);
+  for (size_t window = 1; window <= 20; window++) {
+    AsyncClient client;
+    AsyncCallbackResponse response("text/plain", body.size(), fillerOf(body));
+    CHECK(drain(response, client, [window](int call) { return call == 0 ? 1000 : window; }));
+    std::string received;
+    CHECK(parse(client.sent(), false, received));
+    CHECK(received == body);
+  }
+}
+
+int main() {
+  RUN_TEST(testChunkedThroughSmallWindows);
+  RUN_TEST(testChunkedHeadLeavesLittleRoom);
+  RUN_TEST(testContentLengthThroughSmallWindows);
+  return TEST_RESULT();
+}